@@ -0,0 +1,134 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGAsyncRequest
+#define ROOT_TNetXNGAsyncRequest
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGAsyncRequest                                                        //
+//                                                                            //
+// Asynchronous open, stat, read, vector read or write of a TNetXNGFile.      //
+// Requests are owned by the caller and may be reused once done, so that no   //
+// memory is allocated per request; completions are delivered through Done(), //
+// in the XrdCl thread receiving the response or by a TNetXNGExecutor (e.g.   //
+// a TNetXNGCompletionQueue).                                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include "TNetXNGRateLimiter.h"
+#ifndef __CINT__
+#include <XrdSys/XrdSysPthread.hh>
+#include <XrdCl/XrdClXRootDResponses.hh>
+#include <string>
+#endif
+
+namespace XrdCl {
+   class File;
+   class ResponseHandler;
+   class StatInfo;
+}
+class TNetXNGFile;
+struct FileStat_t;
+class TNetXNGAsyncRequest;
+
+class TNetXNGExecutor {
+public:
+   // Runs the completions of the requests it is given to. Post() is called
+   // from an XrdCl thread and must not block; it typically queues the
+   // request (see TNetXNGAsyncRequest::GetNext) and has another thread call
+   // request->Done(). The request stays in flight until the executor calls
+   // request->Delivered(), when it takes it out of its queue.
+   virtual ~TNetXNGExecutor() {}
+   virtual void Post(TNetXNGAsyncRequest *request) = 0;
+};
+
+class TNetXNGAsyncRequest: public XrdCl::ResponseHandler {
+   friend class TNetXNGFile;
+
+public:
+   enum EType { kNone, kOpen, kStat, kRead, kVectorRead, kWrite };
+
+private:
+#ifndef __CINT__
+   TNetXNGFile         *fFile;     // File the request was sent to
+   TNetXNGExecutor     *fExecutor; // Where to run Done(), 0 = inline
+   TNetXNGAsyncRequest *fNext;     // Link for the queues of the executors
+   EType                fType;     // Kind of the last request
+   XrdCl::ChunkList     fChunks;   // Chunks of a vector read (reused)
+   XrdCl::XRootDStatus  fStatus;   // First error of the request
+   Long64_t             fOffset;   // Offset of a read or write, else -1
+   Long64_t             fLength;   // Bytes requested
+   Long64_t             fStart;    // When it was sent (traced), else 0
+   Long64_t             fBytes;    // Bytes transferred
+   XrdCl::StatInfo     *fStatInfo; // Result of a stat
+   Int_t                fPending;  // XrdCl requests not answered yet
+   Bool_t               fInFlight; // Sent and not done yet
+   TNetXNGRateLimiter::EPriority
+                        fPriority; // How the rate limiter treats it
+   std::string          fHost;     // Data server of the limiter grant
+   Bool_t               fThrottled; // Holds a grant of the rate limiter
+   Bool_t               fDelivering; // Completed, Done() not run yet
+   pthread_t            fDeliverer; // Thread running Done()
+   mutable XrdSysCondVar fCond;    // Protects the members above
+#endif
+
+public:
+   TNetXNGAsyncRequest(TNetXNGExecutor *executor = 0);
+   virtual ~TNetXNGAsyncRequest();
+
+   // Called once the request completed, successfully or not. The request
+   // may be sent again from there; without executor, it is in flight until
+   // Done() returned and must not be deleted from it.
+   virtual void Done() = 0;
+
+   EType                GetType() const { return fType; }
+   Bool_t               IsInFlight() const;
+   Bool_t               IsOK() const;
+   const char          *GetErrorMessage() const;
+   Long64_t             GetLength() const;
+   Long64_t             GetBytes() const;
+   Int_t                GetFileStat(FileStat_t &buf) const;
+   TNetXNGFile         *GetFile() const { return fFile; }
+   TNetXNGExecutor     *GetExecutor() const { return fExecutor; }
+   void                 SetExecutor(TNetXNGExecutor *executor);
+   TNetXNGAsyncRequest *GetNext() const { return fNext; }
+   void                 SetNext(TNetXNGAsyncRequest *next) { fNext = next; }
+   TNetXNGRateLimiter::EPriority
+                        GetPriority() const { return fPriority; }
+   void                 SetPriority(TNetXNGRateLimiter::EPriority priority);
+   void                 Wait() const;
+   void                 Delivered();
+
+#ifndef __CINT__
+   const XrdCl::XRootDStatus &GetStatus() const { return fStatus; }
+   virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                               XrdCl::AnyObject    *response);
+#endif
+
+private:
+#ifndef __CINT__
+   Bool_t Start(TNetXNGFile *file, EType type, Long64_t offset,
+                Long64_t length, Int_t npending);
+   void   Abort(const XrdCl::XRootDStatus &status);
+   void   Fail(const XrdCl::XRootDStatus &status, Int_t nunsent);
+   void   Finish();
+   void   Served(Long64_t bytes);
+   void   Complete(const XrdCl::XRootDStatus &status,
+                   XrdCl::StatInfo *info = 0);
+   void   Deliver();
+   Bool_t Throttle(XrdCl::File *file);
+   void   Unthrottle();
+#endif
+
+   TNetXNGAsyncRequest(const TNetXNGAsyncRequest &other);             // Not implemented
+   TNetXNGAsyncRequest &operator =(const TNetXNGAsyncRequest &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGAsyncRequest
@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGCompletionQueue
+#define ROOT_TNetXNGCompletionQueue
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGCompletionQueue                                                     //
+//                                                                            //
+// Collects completed asynchronous requests (see TNetXNGAsyncRequest) for an  //
+// application running its own event loop. The queue owns a descriptor which //
+// is readable as long as completed requests are waiting (an eventfd on       //
+// Linux, a pipe elsewhere), to be registered with poll/epoll; the requests   //
+// are then drained in batches from the loop.                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGAsyncRequest.h"
+
+class TNetXNGCompletionQueue: public TNetXNGExecutor {
+private:
+#ifndef __CINT__
+   Int_t                fFD[2];  // Readable end, written end (equal for an
+                                 // eventfd)
+   TNetXNGAsyncRequest *fHead;   // Oldest completed request
+   TNetXNGAsyncRequest *fTail;   // Newest completed request
+   Int_t                fSize;   // Number of completed requests
+   mutable XrdSysMutex  fMutex;  // Protects the members above
+#endif
+
+public:
+   TNetXNGCompletionQueue();
+   virtual ~TNetXNGCompletionQueue();
+
+   Bool_t       IsValid() const { return fFD[0] >= 0; }
+   Int_t        GetFD() const { return fFD[0]; }
+   Int_t        GetSize() const;
+   virtual void Post(TNetXNGAsyncRequest *request);
+   Int_t        Drain(TNetXNGAsyncRequest **requests, Int_t max);
+   Int_t        Process(Int_t max = 0);
+
+private:
+   void         Notify();
+   void         Clear();
+
+   TNetXNGCompletionQueue(const TNetXNGCompletionQueue &other);             // Not implemented
+   TNetXNGCompletionQueue &operator =(const TNetXNGCompletionQueue &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGCompletionQueue
@@ -25,12 +25,21 @@
 #include <XrdSys/XrdSysPthread.hh>
 #include <XrdCl/XrdClFileSystem.hh>
 #include <XrdCl/XrdClXRootDResponses.hh>
+#include <map>
+#include <string>
+#include <vector>
 #endif
 
 namespace XrdCl {
    class File;
    class ResponseHandler;
 }
+class TNetXNGFileMap;
+class TNetXNGAsyncRequest;
+class TNetXNGAccessProfile;
+class TNetXNGChecksum;
+class TNetXNGRetiredFile;
+struct FileStat_t;
 
 class TNetXNGFile: public TFile {
 private:
@@ -38,15 +47,62 @@ private:
    XrdCl::File            *fFile;        // Underlying XRootD file
    XrdCl::URL             *fUrl;         // URL of the current file
    XrdCl::OpenFlags::Flags fMode;        // Open mode of the current file
+   XrdCl::StatInfo        *fStatInfo;    // Stat information from the open
    XrdSysCondVar           fInitCondVar; // Used to block an async open request
                                          // if requested
+   Int_t                   fReadvIorMax; // Max size of a readv chunk (cached)
+   Int_t                   fReadvIovMax; // Max number of readv chunks (cached)
+   mutable XrdSysMutex     fMutex;       // Protects the cached values, so
+                                         // that reads can run concurrently
+   std::map<Long64_t, std::vector<char> >
+                           fPrefetched;  // Blocks read at open, by offset;
+                                         // only used during Init
+   Int_t                   fSubStreams;  // Substreams asked for the channel
+                                         // (0 = XrdCl default)
+   Int_t                   fWindow;      // Bytes kept in flight by a large
+                                         // read (0 = no limit)
+   Bool_t                  fAutoTune;    // Adjust the transport settings
+                                         // from the measured throughput
+   Double_t                fMinLatency;  // Lowest small read latency (~RTT)
+   Double_t                fBandwidth;   // Smoothed rate of large reads
+   XrdSysMutex             fRecoveryMutex; // Serializes the recoveries
+   std::vector<TNetXNGRetiredFile *>
+                           fRetired;     // Files replaced by a recovery
+   std::vector<std::string>
+                           fTried;       // Data servers which failed
+   Int_t                   fNRecoveries; // Number of successful recoveries
+   Int_t                   fWholeFile;   // Read the whole file at open: 1 =
+                                         // always, 0 = never, -1 = if small
+   Bool_t                  fInMemory;    // The whole file is in fPrefetched
+                                         // and the remote file is closed
+   TNetXNGAsyncRequest    *fOpenRequest; // Notified when the async open
+                                         // completes
+   Long64_t                fOpenStart;   // When the open was sent (traced)
+   TNetXNGAccessProfile   *fProfile;     // Reads recorded and replayed
+   TNetXNGChecksum        *fChecksum;    // Checksums of the data written
+   Bool_t                  fBatchWrites; // Hold writes back (during Close)
+   std::vector<char>       fWriteData;   // Data of the writes held back
+   std::vector<Long64_t>   fWritePos;    // Their offsets
+   std::vector<Int_t>      fWriteLen;    // Their lengths
+   mutable Int_t           fTraceName;   // Trace id of the name, -1 if none
+   mutable Int_t           fTraceServer; // Trace id of the data server of
+   mutable XrdCl::File    *fTraceFile;   // this XRootD file, -1 if none
 #endif
 
 public:
    TNetXNGFile() :
-         TFile(), fFile(0), fUrl(0), fMode(XrdCl::OpenFlags::None) {}
+         TFile(), fFile(0), fUrl(0), fMode(XrdCl::OpenFlags::None),
+         fStatInfo(0), fInitCondVar(0), fReadvIorMax(0), fReadvIovMax(0),
+         fSubStreams(0), fWindow(0), fAutoTune(kFALSE), fMinLatency(0),
+         fBandwidth(0), fNRecoveries(0), fWholeFile(0), fInMemory(kFALSE),
+         fOpenRequest(0), fOpenStart(0), fProfile(0),
+         fChecksum(0), fBatchWrites(kFALSE), fTraceName(-1),
+         fTraceServer(-1), fTraceFile(0) {}
    TNetXNGFile(const char *url, Option_t *mode = "", const char *title = "",
          Int_t compress = 1, Int_t netopt = 0, Bool_t parallelopen = kFALSE);
+   TNetXNGFile(const char *url, TNetXNGAsyncRequest *request,
+         Option_t *mode = "", const char *title = "", Int_t compress = 1,
+         Int_t netopt = 0);
    virtual ~TNetXNGFile();
 
    virtual void     Init(Bool_t create);
@@ -54,24 +110,93 @@ public:
    virtual void     Seek(Long64_t offset, ERelativeTo position = kBeg);
    virtual void     SetAsyncOpenStatus(EAsyncOpenStatus status);
    virtual Long64_t GetSize() const;
+   virtual Int_t    GetFileStat(FileStat_t &buf) const;
    virtual Int_t    ReOpen(Option_t *modestr);
    virtual Bool_t   IsOpen() const;
    virtual Bool_t   WriteBuffer(const char *buffer, Int_t length);
+   Bool_t           WriteBuffers(const char *buffer, Long64_t *position,
+                                 Int_t *length, Int_t nbuffs);
    virtual Bool_t   ReadBuffer(char *buffer, Int_t length);
    virtual Bool_t   ReadBuffer(char *buffer, Long64_t position, Int_t length);
    virtual Bool_t   ReadBuffers(char *buffer, Long64_t *position, Int_t *length,
                                 Int_t nbuffs);
+   virtual Bool_t   Cp(const char *dst, Bool_t progressbar = kTRUE,
+                       UInt_t buffersize = 1000000);
+   TNetXNGFileMap  *Map(Long64_t maxResident = 0, Int_t readAhead = 0);
+   Int_t            GetSubStreams() const { return fSubStreams; }
+   Int_t            GetWindow() const;
+   Double_t         GetBandwidth() const;
+   Double_t         GetLatency() const;
+   Int_t            GetNRecoveries() const;
+   Bool_t           GetWriteChecksum(const char *type, TString &value) const;
+
+   Bool_t           ReadAsync(TNetXNGAsyncRequest *request, char *buffer,
+                              Long64_t position, Int_t length);
+   Bool_t           ReadBuffersAsync(TNetXNGAsyncRequest *request,
+                                     char *buffer, Long64_t *position,
+                                     Int_t *length, Int_t nbuffs);
+   Bool_t           StatAsync(TNetXNGAsyncRequest *request);
+   Bool_t           WriteAsync(TNetXNGAsyncRequest *request,
+                               const char *buffer, Long64_t position,
+                               Int_t length);
 
 ClassDef( TNetXNGFile, 0 ) // ROOT class definition
 
+protected:
+   virtual Int_t  SysSync(Int_t fd);
+
 private:
    virtual Bool_t IsUseable() const;
+   Bool_t         GetVectorReadLimits(Int_t &maxChunk, Int_t &maxChunks);
+   Bool_t         GetServerChecksum(TString &type, TString &value,
+                                    const char *server = 0);
+   void           VerifyChecksum(const char *server);
+   void           CloseRemote();
+   Bool_t         FlushWrites();
+   void           BumpReadCounters(Long64_t bytes);
+   void           BumpWriteCounters(Long64_t bytes);
+   void           WriteFailed();
+   Int_t          CpChunks(Int_t fd, Long64_t start, Long64_t size,
+                           Int_t nslots, Long64_t chunkSize,
+                           Bool_t progressbar, ULong_t &checksum);
+   void           UpdateStatInfo();
+   void           PrefetchInit();
+   void           StartProfile();
+   Bool_t         ReadVector(char *buffer, Long64_t *position, Int_t *length,
+                             Int_t nbuffs);
+   Bool_t         ReadWholeFile();
+   Bool_t         AdoptInput();
+   Bool_t         ReadPrefetched(char *buffer, Long64_t position, Int_t length);
+   void           OpenRemote(const char *url, Option_t *mode, Int_t netopt,
+                              Bool_t parallelopen);
+   void           ConfigureTransport(Int_t netopt);
+   void           TuneTransport(Long64_t bytes, Double_t elapsed);
 #ifndef __CINT__
+   XrdCl::XRootDStatus OpenFile(XrdCl::ResponseHandler *handler = 0);
+   XrdCl::XRootDStatus RaceOpen(const std::vector<std::string> &hosts);
+   void           AsyncOpenDone(const XrdCl::XRootDStatus &status);
+   XrdCl::XRootDStatus ReadSplit(XrdCl::File *file, char *buffer,
+                                 Long64_t position, Int_t length,
+                                 uint32_t &bytesRead);
+   XrdCl::File   *GetXrdFile() const;
+   void           Trace(Int_t op, Long64_t start, Long64_t offset,
+                        Long64_t size, Int_t nchunks, Bool_t ok,
+                        XrdCl::File *file = 0) const;
+   Bool_t         Recover(XrdCl::File *failed,
+                          const XrdCl::XRootDStatus &status,
+                          Double_t &deadline);
+   static Bool_t  IsRecoverable(const XrdCl::XRootDStatus &status);
+   void           SetStatInfo(XrdCl::StatInfo *info);
    XrdCl::OpenFlags::Flags ParseOpenMode(Option_t *modestr);
+   Bool_t         Prefetch(std::vector<std::pair<Long64_t, Long64_t> > &ranges);
 #endif
 
    TNetXNGFile(const TNetXNGFile &other);             // Not implemented
    TNetXNGFile &operator =(const TNetXNGFile &other); // Not implemented
+
+   friend class TNetXNGAsyncOpenHandler;
+   friend class TNetXNGAsyncRequest;
+   friend class TNetXNGFileMap;
 };
 
 class TNetXNGAsyncOpenHandler: public XrdCl::ResponseHandler {
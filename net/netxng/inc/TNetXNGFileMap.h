@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGFileMap
+#define ROOT_TNetXNGFileMap
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGFileMap                                                             //
+//                                                                            //
+// Read-only memory mapping of a remote XRootD file. Pages are filled lazily  //
+// on first touch through userfaultfd, using vector reads that batch the      //
+// pending faults together with some read-ahead. Only available on Linux     //
+// kernels providing userfaultfd. Pages which cannot be read are made         //
+// inaccessible: touching them raises SIGSEGV rather than returning zeros.   //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#ifndef __CINT__
+#include <XrdSys/XrdSysPthread.hh>
+#include <deque>
+#include <vector>
+#endif
+
+class TNetXNGFile;
+
+class TNetXNGFileMap {
+private:
+#ifndef __CINT__
+   TNetXNGFile          *fFile;         // File mapped (not owned)
+   Long64_t              fSize;         // Size of the remote file
+   char                 *fAddress;      // Start of the mapped region
+   Long64_t              fMapSize;      // Size of the region (page multiple)
+   Long64_t              fPageSize;     // System page size
+   Long64_t              fNPages;       // Number of pages in the region
+   Long64_t              fMaxResident;  // Max resident pages (0 = no cap)
+   Int_t                 fReadAhead;    // Pages fetched after a faulting one
+   Int_t                 fUffd;         // userfaultfd descriptor
+   Int_t                 fWakePipe[2];  // Used to stop the fault thread
+   pthread_t             fThread;       // Fault handling thread
+   Bool_t                fRunning;      // Fault thread has been started
+   std::vector<UChar_t>  fResident;     // Per-page residency flags
+   std::deque<Long64_t>  fResidentList; // Resident pages, oldest first
+   char                 *fStaging;      // Page aligned staging buffer
+   Long64_t              fStagingPages; // Size of the staging buffer in pages
+   mutable XrdSysMutex   fStatsMutex;   // Protects the statistics below
+   Long64_t              fNFaults;      // Number of pages faulted in
+   Long64_t              fNReads;       // Number of vector reads issued
+   Long64_t              fNEvicted;     // Number of pages dropped by the cap
+   Long64_t              fNErrors;      // Number of failed page fills
+#endif
+
+public:
+   TNetXNGFileMap(TNetXNGFile *file, Long64_t size, Long64_t maxResident = 0,
+                  Int_t readAhead = 0);
+   virtual ~TNetXNGFileMap();
+
+   Bool_t      IsValid() const { return fAddress != 0 && fRunning; }
+   const char *GetAddress() const { return fAddress; }
+   Long64_t    GetSize() const { return fSize; }
+   Long64_t    GetResidentBytes() const;
+   Long64_t    GetFaults() const;
+   Long64_t    GetReadCalls() const;
+   Long64_t    GetErrors() const;
+
+private:
+#ifndef __CINT__
+   static void *FaultThread(void *arg);
+   void         HandleFaults();
+   void         FillPages(std::vector<Long64_t> &pages);
+   Bool_t       ReadPages(const std::vector<Long64_t> &pages);
+   void         CopyPages(const std::vector<Long64_t> &pages);
+   void         FailPages(const std::vector<Long64_t> &pages);
+   void         Evict(Long64_t npages);
+   void         Wake(Long64_t page);
+#endif
+
+   TNetXNGFileMap(const TNetXNGFileMap &other);             // Not implemented
+   TNetXNGFileMap &operator =(const TNetXNGFileMap &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGFileMap
@@ -41,6 +41,7 @@ public:
    Bool_t Matches(const char *s);
    Bool_t Stage(const char *path, Option_t *opt = 0);
    Bool_t Stage(TCollection *pathlist, Option_t *opt = 0);
+   Int_t  Prewarm(TCollection *files);
    Bool_t IsValid() const { return (fSystem ? kTRUE : kFALSE); }
 
 private:
@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGInputPipeline
+#define ROOT_TNetXNGInputPipeline
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGInputPipeline                                                       //
+//                                                                            //
+// Opens the next inputs of a list of files read one after the other (e.g.    //
+// by TFileMerger or hadd) ahead of time and fetches their data while the     //
+// current one is processed. The files are then opened as usual, with        //
+// TFile::Open: a TNetXNGFile opened for reading takes over what was fetched  //
+// for its URL.                                                               //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#ifndef __CINT__
+#include <XrdSys/XrdSysPthread.hh>
+#include <map>
+#include <string>
+#include <vector>
+#endif
+
+namespace XrdCl {
+   class File;
+   class StatInfo;
+}
+class TCollection;
+class TNetXNGInput;
+
+class TNetXNGInputPipeline {
+private:
+#ifndef __CINT__
+   std::vector<TNetXNGInput *> fInputs;    // In the order they are used
+   std::vector<pthread_t>      fThreads;   // Loading threads
+   Int_t                       fDepth;     // Inputs loaded ahead
+   Long64_t                    fMaxMemory; // Max bytes held for inputs
+   Long64_t                    fMemory;    // Bytes held for inputs
+   Int_t                       fNext;      // Next input to be loaded
+   Int_t                       fConsumed;  // Inputs taken or skipped
+   Bool_t                      fStop;      // The threads must stop
+   Int_t                       fUsers;     // Files waiting for an input
+   mutable XrdSysCondVar       fCond;      // Protects the members above
+#endif
+
+public:
+   TNetXNGInputPipeline(Int_t depth = 0, Long64_t maxMemory = 0);
+   virtual ~TNetXNGInputPipeline();
+
+   void     Add(const char *url);
+   Int_t    Add(TCollection *files);
+   Bool_t   Start();
+
+   Int_t    GetNInputs() const;
+   Int_t    GetNReady() const;
+   Long64_t GetMemory() const;
+
+#ifndef __CINT__
+   static Bool_t Take(const std::string &url, XrdCl::File *&file,
+                      XrdCl::StatInfo *&info,
+                      std::map<Long64_t, std::vector<char> > &blocks);
+#endif
+
+private:
+#ifndef __CINT__
+   static void *LoadThread(void *arg);
+   void         Load(TNetXNGInput *input);
+   Bool_t       Hold(const std::string &key);
+   Bool_t       TakeInput(const std::string &key, XrdCl::File *&file,
+                          XrdCl::StatInfo *&info,
+                          std::map<Long64_t, std::vector<char> > &blocks);
+#endif
+
+   TNetXNGInputPipeline(const TNetXNGInputPipeline &other);             // Not implemented
+   TNetXNGInputPipeline &operator =(const TNetXNGInputPipeline &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGInputPipeline
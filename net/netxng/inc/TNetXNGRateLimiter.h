@@ -0,0 +1,82 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGRateLimiter
+#define ROOT_TNetXNGRateLimiter
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRateLimiter                                                         //
+//                                                                            //
+// Schedules the requests of all the TNetXNGFile and TNetXNGSystem objects   //
+// of the process. Each request has a priority class: metadata, demand        //
+// (a thread waits for it), prefetch or bulk (copies, staging). Requests are  //
+// limited in bytes per second (token bucket) and in number in flight,        //
+// overall and per data server, and the bytes of prefetch and bulk requests   //
+// in flight are capped; waiting requests go in the order of their classes.   //
+// Prefetches never wait: they are dropped when they cannot go right away.    //
+// See Configure() for the settings.                                          //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#ifndef __CINT__
+#include <string>
+#endif
+
+namespace XrdCl {
+   class File;
+}
+
+class TNetXNGRateLimiter {
+public:
+   enum EPriority { kMetadata, kDemand, kPrefetch, kBulk, kNPriorities };
+
+private:
+   static Bool_t fgEnabled; // Some limit is set
+
+public:
+   static void     Configure();
+   static void     SetLimits(Double_t rate, Int_t maxRequests,
+                             Double_t hostRate = 0, Int_t maxHostRequests = 0,
+                             Long64_t maxLowBytes = 0);
+   static Bool_t   IsEnabled() { return fgEnabled; }
+   static Bool_t   Acquire(const char *host, Long64_t bytes,
+                           EPriority priority = kDemand);
+   static void     Release(const char *host, Long64_t bytes,
+                           EPriority priority = kDemand);
+   static Long64_t GetNDelayed();
+   static Long64_t GetNRefused();
+   static Long64_t GetLowBytesInFlight();
+};
+
+#ifndef __CINT__
+//______________________________________________________________________________
+// Holds a grant of the limiter for the lifetime of the object
+class TNetXNGRateGuard {
+private:
+   std::string                   fHost;     // Server the grant is for
+   Long64_t                      fBytes;    // Size of the transfer
+   TNetXNGRateLimiter::EPriority fPriority; // Class of the request
+   Bool_t                        fHeld;     // A grant was acquired
+
+public:
+   TNetXNGRateGuard(const XrdCl::File *file, Long64_t bytes,
+                    TNetXNGRateLimiter::EPriority priority =
+                    TNetXNGRateLimiter::kDemand);
+   TNetXNGRateGuard(const std::string &host, Long64_t bytes,
+                    TNetXNGRateLimiter::EPriority priority);
+   ~TNetXNGRateGuard();
+
+private:
+   TNetXNGRateGuard(const TNetXNGRateGuard &other);             // Not implemented
+   TNetXNGRateGuard &operator =(const TNetXNGRateGuard &other); // Not implemented
+};
+#endif
+
+#endif // ROOT_TNetXNGRateLimiter
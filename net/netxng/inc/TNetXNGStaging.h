@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGStaging
+#define ROOT_TNetXNGStaging
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGStaging                                                             //
+//                                                                            //
+// Tracks an asynchronous staging request issued by TNetXNGSystem, so that    //
+// files can be processed as soon as they come online.                        //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#ifndef __CINT__
+#include <XrdSys/XrdSysPthread.hh>
+#include <string>
+#include <vector>
+#endif
+
+namespace XrdCl {
+   class FileSystem;
+}
+class TCollection;
+
+class TNetXNGStageMonitor {
+public:
+   // Receives the state changes of the files of a staging request. Calls
+   // are made from TNetXNGStaging::Poll, in the thread calling it.
+   virtual ~TNetXNGStageMonitor() {}
+   virtual void Online(const char * /*path*/) {}
+   virtual void Failed(const char * /*path*/, const char * /*error*/) {}
+};
+
+class TNetXNGStaging {
+public:
+   enum EFileState { kPending, kOnline, kFailed };
+
+private:
+#ifndef __CINT__
+   XrdCl::FileSystem        *fFileSystem; // Where to send requests
+   TNetXNGStageMonitor      *fMonitor;    // User monitor, may be 0
+   Int_t                     fWindow;     // Max requests in flight
+   std::vector<std::string>  fPaths;      // Paths of the files
+   std::vector<Int_t>        fStates;     // EFileState of each file
+   std::vector<std::string>  fErrors;     // Last error of each file
+   std::vector<std::string>  fRequestIds; // One per prepare batch
+   Int_t                     fNOnline;    // Files known to be online
+   Int_t                     fNFailed;    // Files which failed
+   XrdSysMutex               fMutex;      // Protects the members above
+#endif
+
+public:
+   TNetXNGStaging(const char *url, TNetXNGStageMonitor *monitor = 0,
+                  Int_t window = 0);
+   virtual ~TNetXNGStaging();
+
+   Int_t       Prepare(TCollection *files, UChar_t priority,
+                       Int_t batchSize = 0);
+   Int_t       Poll();
+   Bool_t      Wait(Int_t timeout = -1, Int_t interval = 10);
+
+   Int_t       GetNFiles() const;
+   Int_t       GetNOnline() const { return fNOnline; }
+   Int_t       GetNFailed() const { return fNFailed; }
+   Int_t       GetNPending() const { return GetNFiles() - fNOnline - fNFailed; }
+   const char *GetPath(Int_t i) const;
+   Int_t       GetState(Int_t i) const;
+   Int_t       GetNRequests() const;
+   const char *GetRequestId(Int_t i) const;
+
+#ifndef __CINT__
+   void        SetState(Int_t i, EFileState state, const std::string &error);
+   void        AddRequestId(const std::string &id);
+#endif
+
+private:
+   TNetXNGStaging(const TNetXNGStaging &other);             // Not implemented
+   TNetXNGStaging &operator =(const TNetXNGStaging &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGStaging
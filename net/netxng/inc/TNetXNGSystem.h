@@ -28,6 +28,22 @@
 namespace XrdCl {
    class FileSystem;
 }
+class TNetXNGStaging;
+class TNetXNGStageMonitor;
+class TList;
+
+class TNetXNGCopyMonitor {
+public:
+   // Receives the progress of the jobs of a third-party copy. Calls are
+   // serialized, even when several jobs run at the same time.
+   virtual ~TNetXNGCopyMonitor() {}
+   virtual void   Begin(Int_t /*job*/, const char * /*source*/,
+                        const char * /*destination*/) {}
+   virtual void   Progress(Int_t /*job*/, Long64_t /*bytes*/,
+                           Long64_t /*total*/) {}
+   virtual void   End(Int_t /*job*/, Bool_t /*ok*/, const char * /*error*/) {}
+   virtual Bool_t ShouldCancel(Int_t /*job*/) { return kFALSE; }
+};
 
 class TNetXNGSystem: public TSystem {
 
@@ -49,10 +65,30 @@ public:
    virtual Int_t       GetPathInfo(const char* path, FileStat_t &buf);
    virtual Bool_t      ConsistentWith(const char *path, void *dirptr);
    virtual int         Unlink(const char *path);
+   virtual Int_t       UnlinkAll(TCollection *paths, Bool_t recursive = kFALSE,
+                                 Int_t window = 0);
+   virtual Int_t       MakeDirectories(TCollection *dirs, Int_t window = 0);
+   virtual Int_t       Prewarm(TCollection *urls, Int_t window = 0);
    virtual Bool_t      IsPathLocal(const char *path);
    virtual Int_t       Locate(const char* path, TString &endurl);
    virtual Int_t       Stage(const char* path, UChar_t priority);
    virtual Int_t       Stage(TCollection *files, UChar_t priority);
+   TNetXNGStaging     *StageAsync(TCollection *files, UChar_t priority,
+                                  TNetXNGStageMonitor *monitor = 0,
+                                  Int_t batchSize = 0);
+   virtual Int_t       GetChecksum(const char *path, TString &type,
+                                   TString &value);
+   virtual Int_t       GetChecksums(TCollection *paths, TList *checksums,
+                                    Int_t window = 0);
+   static Bool_t       ParseChecksum(const char *response, TString &type,
+                                     TString &value);
+   static void         FillFileStat(const XrdCl::StatInfo *info,
+                                    FileStat_t &buf);
+   virtual Int_t       ThirdPartyCopy(TCollection *sources,
+                                      TCollection *destinations,
+                                      Int_t parallel = 4,
+                                      TNetXNGCopyMonitor *monitor = 0,
+                                      Bool_t force = kFALSE);
 
 ClassDef(TNetXNGSystem, 0 ) // ROOT class definition
 };
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGTrace
+#define ROOT_TNetXNGTrace
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGTrace                                                               //
+//                                                                            //
+// Records the requests issued by TNetXNGFile and TNetXNGSystem in a ring     //
+// buffer (operation, file, data server, offset, size, chunks, duration) and  //
+// writes them in the Chrome trace event format, which chrome://tracing and   //
+// Perfetto display as a timeline. Disabled by default: NetXNG.Trace set to   //
+// the number of events to keep enables it, NetXNG.TraceFile names a file     //
+// the trace is written to at exit.                                           //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+
+class TNetXNGTrace {
+public:
+   enum EOperation { kOpen, kClose, kStat, kRead, kVectorRead, kWrite,
+                     kSync, kLocate, kQuery, kPrepare, kRemove, kMkDir,
+                     kDirList, kCopy, kNOperations };
+
+private:
+   static Bool_t fgEnabled; // Events are being recorded
+
+public:
+   static void     Configure();
+   static void     Enable(Int_t capacity = 0);
+   static void     Disable();
+   static Bool_t   IsEnabled() { return fgEnabled; }
+   static Long64_t Now();
+   static void     Record(EOperation op, Long64_t start, const char *file,
+                          const char *server, Long64_t offset, Long64_t size,
+                          Int_t nchunks, Bool_t ok);
+   static void     Record(EOperation op, Long64_t start, Int_t file,
+                          Int_t server, Long64_t offset, Long64_t size,
+                          Int_t nchunks, Bool_t ok);
+   static Int_t    Intern(const char *name);
+   static void     ReleaseName(Int_t id);
+   static Int_t    GetNEvents();
+   static void     Clear();
+   static Bool_t   Dump(const char *path);
+};
+
+#endif // ROOT_TNetXNGTrace
@@ -0,0 +1,440 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGAccessProfile                                                       //
+//                                                                            //
+// Internal helper of TNetXNGFile recording the sequence of reads of a file,  //
+// stored compactly per file identity, and replaying the sequence recorded    //
+// by a previous job as asynchronous vector reads ahead of the consumer.      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGAccessProfile.h"
+#include "TNetXNGAsyncRequest.h"
+#include "TNetXNGFile.h"
+#include "TString.h"
+#include "TEnv.h"
+#include "TError.h"
+#include "TMath.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+//______________________________________________________________________________
+// Consecutive reads of a profile fetched with one asynchronous vector read
+class TNetXNGProfileBlock: public TNetXNGAsyncRequest {
+public:
+   enum EState { kPending, kInFlight, kReady, kFailed, kDropped };
+
+   TNetXNGAccessProfile *fProfile; // Profile the block belongs to
+   Int_t                 fFirst;   // First read of the block
+   Int_t                 fLast;    // One past the last read of the block
+   Long64_t              fSize;    // Bytes of the reads
+   std::vector<char>     fData;    // Data, while sent or landed
+   Int_t                 fState;   // EState
+
+   TNetXNGProfileBlock(TNetXNGAccessProfile *profile, Int_t first) :
+      fProfile(profile), fFirst(first), fLast(first), fSize(0),
+      fState(kPending) { SetPriority(TNetXNGRateLimiter::kPrefetch); }
+
+   virtual void Done() { fProfile->BlockDone(this); }
+
+   void Release()
+   {
+      // Free the data of the block
+      std::vector<char>().swap(fData);
+   }
+};
+
+namespace {
+
+   // Format of the stored profiles: magic, number of reads, then for each
+   // read the zigzag encoded distance from the end of the previous one and
+   // its length, as base 128 varints. Typical reads take 3 to 5 bytes.
+   const char  kProfileMagic[4] = { 'N', 'X', 'P', '1' };
+
+   // Size of the vector reads replaying a profile
+   const Long64_t kBlockSize = 4194304;
+
+   //___________________________________________________________________________
+   void PutVarint(std::string &out, ULong64_t value)
+   {
+      // Append a base 128 varint
+
+      while (value >= 0x80) {
+         out += (char) ((value & 0x7f) | 0x80);
+         value >>= 7;
+      }
+      out += (char) value;
+   }
+
+   //___________________________________________________________________________
+   Bool_t GetVarint(const char *&in, const char *end, ULong64_t &value)
+   {
+      // Decode a base 128 varint, kFALSE if the input is truncated
+
+      value = 0;
+      for (Int_t shift = 0; in < end && shift < 64; shift += 7) {
+         UChar_t c = *in++;
+         value |= (ULong64_t) (c & 0x7f) << shift;
+         if (!(c & 0x80))
+            return kTRUE;
+      }
+      return kFALSE;
+   }
+}
+
+//______________________________________________________________________________
+TNetXNGAccessProfile::TNetXNGAccessProfile(TNetXNGFile       *file,
+                                           const std::string &path) :
+   fFile(file), fPath(path), fMaxEntries(1000000), fNextBlock(0),
+   fFirstLive(0), fConsumer(-1), fWindow(0), fAhead(0), fInFlight(0),
+   fNHits(0), fStopped(kFALSE), fCond(0)
+{
+   // Constructor
+   //
+   // param file: the file whose reads are recorded and replayed
+   // param path: where the profile of the file is stored
+   //
+   // At most NetXNG.ProfileMaxEntries reads (default 1000000) are recorded
+   // and replayed.
+
+   fMaxEntries = gEnv->GetValue("NetXNG.ProfileMaxEntries", 1000000);
+}
+
+//______________________________________________________________________________
+TNetXNGAccessProfile::~TNetXNGAccessProfile()
+{
+   // Destructor. Waits for the blocks in flight.
+
+   Stop();
+
+   // A block is in flight until its Done() returned
+   for (UInt_t i = 0; i < fBlocks.size(); ++i) {
+      fBlocks[i]->Wait();
+      delete fBlocks[i];
+   }
+}
+
+//______________________________________________________________________________
+std::string TNetXNGAccessProfile::GetProfilePath(const char        *dir,
+                                                 const std::string &key)
+{
+   // Get where the profile of a file is stored
+   //
+   // param dir: the profile directory
+   // param key: identity of the file (path, size, modification time)
+
+   return std::string(dir) + "/" + TString(key.c_str()).MD5().Data() +
+          ".nxprof";
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::Record(Long64_t offset, Int_t length)
+{
+   // Record a read of the consumer
+
+   XrdSysCondVarHelper lock(fCond);
+   if ((Long64_t) fRecorded.size() < fMaxEntries && length > 0)
+      fRecorded.push_back(std::make_pair(offset, length));
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAccessProfile::Save()
+{
+   // Store the recorded reads, replacing the previous profile
+   //
+   // returns: kTRUE in case of success
+
+   std::string data(kProfileMagic, sizeof(kProfileMagic));
+   {
+      XrdSysCondVarHelper lock(fCond);
+      if (fRecorded.empty())
+         return kFALSE;
+
+      PutVarint(data, fRecorded.size());
+      Long64_t end = 0;
+      for (UInt_t i = 0; i < fRecorded.size(); ++i) {
+         Long64_t delta = fRecorded[i].first - end;
+         PutVarint(data, ((ULong64_t) delta << 1) ^ (ULong64_t) (delta >> 63));
+         PutVarint(data, fRecorded[i].second);
+         end = fRecorded[i].first + fRecorded[i].second;
+      }
+   }
+
+   // Written aside then renamed, for concurrent jobs to see whole profiles
+   std::string tmp = fPath + Form(".%d", (Int_t) getpid());
+   FILE *out = fopen(tmp.c_str(), "wb");
+   if (!out) {
+      ::SysError("TNetXNGAccessProfile::Save", "cannot write %s", tmp.c_str());
+      return kFALSE;
+   }
+   Bool_t ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+   ok = !fclose(out) && ok;
+   if (!ok || rename(tmp.c_str(), fPath.c_str())) {
+      ::SysError("TNetXNGAccessProfile::Save", "cannot write %s",
+                 fPath.c_str());
+      remove(tmp.c_str());
+      return kFALSE;
+   }
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAccessProfile::Load(Long64_t fileSize)
+{
+   // Load the profile stored by a previous job, if any
+   //
+   // param fileSize: size of the file; reads beyond are ignored
+   // returns:        kTRUE if there is something to replay
+
+   FILE *in = fopen(fPath.c_str(), "rb");
+   if (!in)
+      return kFALSE;
+
+   std::string data;
+   char buffer[65536];
+   size_t n;
+   while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+      data.append(buffer, n);
+   fclose(in);
+
+   if (data.size() < sizeof(kProfileMagic) ||
+       memcmp(data.data(), kProfileMagic, sizeof(kProfileMagic))) {
+      ::Warning("TNetXNGAccessProfile::Load", "%s: not a profile",
+                fPath.c_str());
+      return kFALSE;
+   }
+
+   const char *cursor = data.data() + sizeof(kProfileMagic);
+   const char *end    = data.data() + data.size();
+   ULong64_t count, delta, length;
+   if (!GetVarint(cursor, end, count))
+      return kFALSE;
+
+   Long64_t last = 0;
+   for (ULong64_t i = 0; i < count && (Long64_t) i < fMaxEntries; ++i) {
+      if (!GetVarint(cursor, end, delta) || !GetVarint(cursor, end, length))
+         break;
+      Long64_t offset = last + (Long64_t) ((delta >> 1) ^ (~(delta & 1) + 1));
+      last = offset + length;
+      if (offset < 0 || length == 0 || length > 0x7fffffff ||
+          offset + (Long64_t) length > fileSize)
+         continue;
+      fProfile.push_back(std::make_pair(offset, (Int_t) length));
+   }
+
+   return !fProfile.empty();
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::Start(Long64_t window, Int_t maxRead,
+                                 Int_t maxChunks)
+{
+   // Start replaying the loaded profile: its reads are grouped in vector
+   // reads which are sent in order, at most window bytes ahead of the
+   // consumer
+   //
+   // param window:    max bytes sent or landed and not consumed yet
+   // param maxRead:   max size of a vector read chunk
+   // param maxChunks: max number of chunks of a vector read
+
+   XrdSysCondVarHelper lock(fCond);
+   fWindow = window;
+
+   TNetXNGProfileBlock *block = 0;
+   Int_t chunks = 0;
+   fEntryBlock.resize(fProfile.size());
+   fEntryPos.resize(fProfile.size());
+   for (Int_t i = 0; i < (Int_t) fProfile.size(); ++i) {
+      Int_t length = fProfile[i].second;
+      Int_t nsplit = (length + maxRead - 1) / maxRead;
+      if (!block || block->fSize + length > kBlockSize ||
+          chunks + nsplit > maxChunks) {
+         block = new TNetXNGProfileBlock(this, i);
+         fBlocks.push_back(block);
+         chunks = 0;
+      }
+      fEntryBlock[i] = fBlocks.size() - 1;
+      fEntryPos[i]   = block->fSize;
+      fEntries.insert(std::make_pair(fProfile[i].first, i));
+      block->fLast  = i + 1;
+      block->fSize += length;
+      chunks       += nsplit;
+   }
+
+   Pump();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAccessProfile::Read(char *buffer, Long64_t offset, Int_t length)
+{
+   // Serve a read of the consumer from the replayed profile. A read whose
+   // block is in flight waits for it rather than being sent again. Blocks
+   // the rate limiter refused are sent again from here.
+   //
+   // param buffer: where to copy the data
+   // param offset: offset from the beginning of the file
+   // param length: number of bytes to be read
+   // returns:      kTRUE if the read was served
+
+   fCond.Lock();
+   std::pair<std::multimap<Long64_t, Int_t>::iterator,
+             std::multimap<Long64_t, Int_t>::iterator> range =
+      fEntries.equal_range(offset);
+
+   for (std::multimap<Long64_t, Int_t>::iterator it = range.first;
+        it != range.second; ++it) {
+      Int_t entry = it->second;
+      if (fProfile[entry].second < length)
+         continue;
+
+      TNetXNGProfileBlock *block = fBlocks[fEntryBlock[entry]];
+      while (block->fState == TNetXNGProfileBlock::kInFlight)
+         fCond.Wait();
+
+      if (block->fState == TNetXNGProfileBlock::kReady) {
+         memcpy(buffer, &block->fData[fEntryPos[entry]], length);
+         ++fNHits;
+         Passed(entry);
+         Pump();
+         fCond.UnLock();
+         return kTRUE;
+      }
+
+      // The consumer is ahead of the prefetch: catch up
+      if (block->fState == TNetXNGProfileBlock::kPending) {
+         Passed(entry);
+         break;
+      }
+   }
+
+   Pump();
+   fCond.UnLock();
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::Stop()
+{
+   // Stop the replay, waiting for the blocks in flight
+
+   fCond.Lock();
+   fStopped = kTRUE;
+   while (fInFlight)
+      fCond.Wait();
+   fCond.UnLock();
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::Pump()
+{
+   // Send the next blocks as long as the window allows; called with fCond
+   // locked, which is released while sending. Several threads may pump at
+   // the same time: only the blocks still pending are taken, and a refused
+   // block moves the cursor back to it, not past another thread's blocks.
+
+   while (!fStopped && fNextBlock < (Int_t) fBlocks.size() &&
+          fAhead < fWindow) {
+      Int_t index = fNextBlock++;
+      TNetXNGProfileBlock *block = fBlocks[index];
+      if (block->fState != TNetXNGProfileBlock::kPending)
+         continue;
+      if (block->fLast <= fConsumer + 1) {
+         block->fState = TNetXNGProfileBlock::kDropped;
+         continue;
+      }
+
+      std::vector<Long64_t> positions;
+      std::vector<Int_t>    lengths;
+      for (Int_t i = block->fFirst; i < block->fLast; ++i) {
+         positions.push_back(fProfile[i].first);
+         lengths.push_back(fProfile[i].second);
+      }
+      block->fData.resize(block->fSize);
+      block->fState = TNetXNGProfileBlock::kInFlight;
+      fAhead += block->fSize;
+      ++fInFlight;
+
+      fCond.UnLock();
+      Bool_t failed = fFile->ReadBuffersAsync(block, &block->fData[0],
+                                              &positions[0], &lengths[0],
+                                              positions.size());
+      fCond.Lock();
+
+      if (failed && block->GetStatus().code == XrdCl::errRetry) {
+
+         // Refused by the rate limiter: sent again on the next read
+         block->fState = TNetXNGProfileBlock::kPending;
+         block->Release();
+         fAhead -= block->fSize;
+         --fInFlight;
+         fNextBlock = TMath::Min(fNextBlock, index);
+         fCond.Broadcast();
+         break;
+      }
+
+      if (failed) {
+         block->fState = TNetXNGProfileBlock::kFailed;
+         block->Release();
+         fAhead -= block->fSize;
+         --fInFlight;
+         fStopped = kTRUE;
+         fCond.Broadcast();
+      }
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::BlockDone(TNetXNGProfileBlock *block)
+{
+   // Called when the vector read of a block completed
+
+   XrdSysCondVarHelper lock(fCond);
+   if (block->IsOK() && block->GetBytes() == block->fSize) {
+      block->fState = TNetXNGProfileBlock::kReady;
+      if (block->fLast <= fConsumer + 1) {
+         block->fState = TNetXNGProfileBlock::kDropped;
+         block->Release();
+         fAhead -= block->fSize;
+      }
+   } else {
+      block->fState = TNetXNGProfileBlock::kFailed;
+      block->Release();
+      fAhead -= block->fSize;
+   }
+   --fInFlight;
+   fCond.Broadcast();
+   Pump();
+}
+
+//______________________________________________________________________________
+void TNetXNGAccessProfile::Passed(Int_t entry)
+{
+   // The consumer reached a read of the profile: the blocks it is done with
+   // are dropped, which lets the next ones be sent. Called with fCond locked.
+
+   if (entry <= fConsumer)
+      return;
+   fConsumer = entry;
+
+   for (; fFirstLive < (Int_t) fBlocks.size(); ++fFirstLive) {
+      TNetXNGProfileBlock *block = fBlocks[fFirstLive];
+      if (block->fLast > fConsumer + 1)
+         break;
+      if (block->fState == TNetXNGProfileBlock::kInFlight)
+         break;
+      if (block->fState == TNetXNGProfileBlock::kReady) {
+         block->fState = TNetXNGProfileBlock::kDropped;
+         block->Release();
+         fAhead -= block->fSize;
+      }
+   }
+}
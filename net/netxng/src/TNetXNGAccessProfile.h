@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGAccessProfile
+#define ROOT_TNetXNGAccessProfile
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGAccessProfile                                                       //
+//                                                                            //
+// Internal helper of TNetXNGFile recording the sequence of reads of a file,  //
+// stored compactly per file identity, and replaying the sequence recorded    //
+// by a previous job as asynchronous vector reads ahead of the consumer.      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include <XrdSys/XrdSysPthread.hh>
+#include <map>
+#include <string>
+#include <vector>
+
+class TNetXNGFile;
+class TNetXNGProfileBlock;
+
+class TNetXNGAccessProfile {
+   friend class TNetXNGProfileBlock;
+
+private:
+   TNetXNGFile                        *fFile;        // File being read
+   std::string                         fPath;        // Where the profile is
+                                                     // stored
+   Long64_t                            fMaxEntries;  // Max reads recorded
+   std::vector<std::pair<Long64_t, Int_t> >
+                                       fRecorded;    // Reads of this job
+   std::vector<std::pair<Long64_t, Int_t> >
+                                       fProfile;     // Reads of a previous
+                                                     // job, being replayed
+   std::multimap<Long64_t, Int_t>      fEntries;     // Replayed reads by
+                                                     // offset
+   std::vector<Int_t>                  fEntryBlock;  // Block of each read
+   std::vector<Long64_t>               fEntryPos;    // Position in the block
+   std::vector<TNetXNGProfileBlock *>  fBlocks;      // Reads grouped in
+                                                     // vector reads
+   Int_t                               fNextBlock;   // Next block to send
+   Int_t                               fFirstLive;   // First block not
+                                                     // passed yet
+   Int_t                               fConsumer;    // Last replayed read
+                                                     // served
+   Long64_t                            fWindow;      // Max bytes ahead
+   Long64_t                            fAhead;       // Bytes sent or landed
+                                                     // and not passed yet
+   Int_t                               fInFlight;    // Blocks in flight
+   Long64_t                            fNHits;       // Reads served
+   Bool_t                              fStopped;     // No more blocks sent
+   XrdSysCondVar                       fCond;        // Protects the above
+
+public:
+   TNetXNGAccessProfile(TNetXNGFile *file, const std::string &path);
+   ~TNetXNGAccessProfile();
+
+   static std::string GetProfilePath(const char *dir, const std::string &key);
+
+   void     Record(Long64_t offset, Int_t length);
+   Bool_t   Save();
+   Bool_t   Load(Long64_t fileSize);
+   void     Start(Long64_t window, Int_t maxRead, Int_t maxChunks);
+   Bool_t   Read(char *buffer, Long64_t offset, Int_t length);
+   void     Stop();
+   Long64_t GetNHits() const { return fNHits; }
+
+private:
+   void     Pump();
+   void     BlockDone(TNetXNGProfileBlock *block);
+   void     Passed(Int_t entry);
+
+   TNetXNGAccessProfile(const TNetXNGAccessProfile &other);             // Not implemented
+   TNetXNGAccessProfile &operator =(const TNetXNGAccessProfile &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGAccessProfile
@@ -0,0 +1,440 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGAsyncRequest                                                        //
+//                                                                            //
+// Asynchronous open, stat, read, vector read or write of a TNetXNGFile.      //
+// Requests are owned by the caller and may be reused once done, so that no   //
+// memory is allocated per request; completions are delivered through Done(), //
+// in the XrdCl thread receiving the response or by a TNetXNGExecutor (e.g.   //
+// a TNetXNGCompletionQueue).                                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGAsyncRequest.h"
+#include "TNetXNGFile.h"
+#include "TNetXNGSystem.h"
+#include "TNetXNGTrace.h"
+#include "TError.h"
+#include <XrdCl/XrdClFile.hh>
+
+//______________________________________________________________________________
+TNetXNGAsyncRequest::TNetXNGAsyncRequest(TNetXNGExecutor *executor) :
+   fFile(0), fExecutor(executor), fNext(0), fType(kNone), fOffset(-1),
+   fLength(0), fStart(0), fBytes(0), fStatInfo(0), fPending(0),
+   fInFlight(kFALSE), fPriority(TNetXNGRateLimiter::kDemand),
+   fThrottled(kFALSE), fDelivering(kFALSE), fDeliverer(0), fCond(0)
+{
+   // Constructor
+   //
+   // param executor: runs Done() when the request completes, 0 to run it in
+   //                 the XrdCl thread which received the response
+}
+
+//______________________________________________________________________________
+TNetXNGAsyncRequest::~TNetXNGAsyncRequest()
+{
+   // Destructor. The request must not be in flight.
+
+   if (IsInFlight())
+      ::Error("TNetXNGAsyncRequest::~TNetXNGAsyncRequest",
+              "deleting a request which is still in flight");
+   delete fStatInfo;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAsyncRequest::IsInFlight() const
+{
+   // Check if the request was sent and did not complete yet
+
+   XrdSysCondVarHelper lock(fCond);
+   return fInFlight;
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Wait() const
+{
+   // Wait until the request is not in flight anymore, i.e. until its Done()
+   // returned or its executor took it over. Not to be called from Done().
+
+   XrdSysCondVarHelper lock(fCond);
+   while (fInFlight)
+      fCond.Wait();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAsyncRequest::IsOK() const
+{
+   // Check if the last request succeeded
+
+   XrdSysCondVarHelper lock(fCond);
+   return fStatus.IsOK();
+}
+
+//______________________________________________________________________________
+const char *TNetXNGAsyncRequest::GetErrorMessage() const
+{
+   // Get the error message of the last request, empty if it succeeded. The
+   // string is valid until the request is sent again.
+
+   XrdSysCondVarHelper lock(fCond);
+   return fStatus.GetErrorMessage().c_str();
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGAsyncRequest::GetLength() const
+{
+   // Get the number of bytes asked for by the last request
+
+   XrdSysCondVarHelper lock(fCond);
+   return fLength;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGAsyncRequest::GetBytes() const
+{
+   // Get the number of bytes read or written by the last request; a read
+   // may return less than asked for at the end of the file
+
+   XrdSysCondVarHelper lock(fCond);
+   return fBytes;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGAsyncRequest::GetFileStat(FileStat_t &buf) const
+{
+   // Get the result of the last stat request
+   //
+   // param buf: structure that will hold the stat info (out)
+   // returns:   0 in case of success, 1 if the stat failed
+
+   XrdSysCondVarHelper lock(fCond);
+   if (fType != kStat || !fStatInfo)
+      return 1;
+
+   TNetXNGSystem::FillFileStat(fStatInfo, buf);
+   return 0;
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::SetExecutor(TNetXNGExecutor *executor)
+{
+   // Change where Done() runs, only while the request is not in flight
+
+   XrdSysCondVarHelper lock(fCond);
+   if (!fInFlight)
+      fExecutor = executor;
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::SetPriority(TNetXNGRateLimiter::EPriority priority)
+{
+   // Set the class of the request for the scheduling of TNetXNGRateLimiter
+   // (kDemand by default; stats are always kMetadata). Demand and bulk
+   // requests wait for their turn, prefetches are refused when they cannot
+   // go right away, the request failing with errRetry. Only while the
+   // request is not in flight.
+
+   XrdSysCondVarHelper lock(fCond);
+   if (!fInFlight)
+      fPriority = priority;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAsyncRequest::Start(TNetXNGFile *file, EType type,
+                                  Long64_t offset, Long64_t length,
+                                  Int_t npending)
+{
+   // Prepare the request for being sent
+   //
+   // param file:     the file the request goes to
+   // param type:     the kind of request
+   // param offset:   offset of a read or write, -1 otherwise
+   // param length:   number of bytes asked for
+   // param npending: number of XrdCl requests it is made of
+   // returns:        kFALSE if the request is still in flight
+
+   XrdSysCondVarHelper lock(fCond);
+   if (fInFlight && !(fDelivering && pthread_equal(fDeliverer,
+                                                   pthread_self())))
+      return kFALSE;
+
+   fFile     = file;
+   fType     = type;
+   fStatus   = XrdCl::XRootDStatus();
+   fOffset   = offset;
+   fLength   = length;
+   fStart    = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   fBytes    = 0;
+   fPending  = npending;
+   delete fStatInfo;
+   fStatInfo = 0;
+   fInFlight = kTRUE;
+   fDelivering = kFALSE;
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Abort(const XrdCl::XRootDStatus &status)
+{
+   // Give up a request none of whose parts could be sent. Done() is not
+   // called.
+
+   Unthrottle();
+   XrdSysCondVarHelper lock(fCond);
+   fStatus   = status;
+   fInFlight = kFALSE;
+   fCond.Broadcast();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Fail(const XrdCl::XRootDStatus &status,
+                               Int_t nunsent)
+{
+   // Account for the parts of a request which could not be sent after
+   // others were
+   //
+   // param status:  the error of the send
+   // param nunsent: number of parts which will not be answered
+
+   Bool_t last;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      if (fStatus.IsOK())
+         fStatus = status;
+      fPending -= nunsent;
+      last = (fPending == 0);
+   }
+   if (last)
+      Finish();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::HandleResponse(XrdCl::XRootDStatus *status,
+                                         XrdCl::AnyObject    *response)
+{
+   // Called when the response to one part of the request arrives or an
+   // error occurs
+
+   using namespace XrdCl;
+
+   Long64_t bytes = 0;
+   if (status->IsOK() && response) {
+      if (fType == kRead) {
+         ChunkInfo *info = 0;
+         response->Get(info);
+         if (info) bytes = info->length;
+      } else if (fType == kVectorRead) {
+         VectorReadInfo *info = 0;
+         response->Get(info);
+         if (info) bytes = info->GetSize();
+      } else if (fType == kStat) {
+         StatInfo *info = 0;
+         response->Get(info);
+         if (info) {
+            XrdSysCondVarHelper lock(fCond);
+            fStatInfo = new StatInfo(*info);
+         }
+      }
+   }
+   delete response;
+
+   Bool_t last;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      if (!status->IsOK() && fStatus.IsOK())
+         fStatus = *status;
+      fBytes += bytes;
+      last = (--fPending == 0);
+      if (last && fType == kWrite && fStatus.IsOK())
+         fBytes = fLength;
+   }
+   delete status;
+
+   if (last)
+      Finish();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Finish()
+{
+   // Complete the request: account for the data and hand the request over
+   // to the caller. The request may be reused or deleted as soon as it is
+   // marked done, so it must not be touched afterwards.
+
+   TNetXNGFile *file;
+   Long64_t     bytes, offset, length, start;
+   Int_t        nchunks;
+   EType        type;
+   Bool_t       ok;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      file    = fFile;
+      bytes   = fBytes;
+      type    = fType;
+      offset  = fOffset;
+      length  = fLength;
+      start   = fStart;
+      nchunks = type == kVectorRead ? fChunks.size() : 1;
+      ok      = fStatus.IsOK();
+   }
+
+   if (start) {
+      TNetXNGTrace::EOperation op = TNetXNGTrace::kRead;
+      if (type == kVectorRead)  op = TNetXNGTrace::kVectorRead;
+      else if (type == kWrite)  op = TNetXNGTrace::kWrite;
+      else if (type == kStat)   op = TNetXNGTrace::kStat;
+      file->Trace(op, start, offset, length, nchunks, ok);
+   }
+
+   Unthrottle();
+   if (type == kWrite && !ok)
+      file->WriteFailed();
+   if (type == kWrite)
+      file->BumpWriteCounters(bytes);
+   else if (type != kStat)
+      file->BumpReadCounters(bytes);
+
+   Deliver();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Served(Long64_t bytes)
+{
+   // Complete a read served from memory by the file, without any request
+   // sent to the server
+   //
+   // param bytes: number of bytes copied
+
+   {
+      XrdSysCondVarHelper lock(fCond);
+      fBytes   = bytes;
+      fPending = 0;
+   }
+   Deliver();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Complete(const XrdCl::XRootDStatus &status,
+                                   XrdCl::StatInfo *info)
+{
+   // Complete a request handled by the file itself (open, or stat of a
+   // file held in memory)
+   //
+   // param status: the outcome of the request
+   // param info:   stat information, owned by the request afterwards
+
+   {
+      XrdSysCondVarHelper lock(fCond);
+      fStatus   = status;
+      fPending  = 0;
+      delete fStatInfo;
+      fStatInfo = info;
+   }
+   Deliver();
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Deliver()
+{
+   // Hand the completed request over to the executor, or run Done(). The
+   // request stays in flight until Done() returned, unless it was sent
+   // again from there, or until the executor took it (see Delivered()), so
+   // that it is not reused or deleted while being delivered.
+
+   TNetXNGExecutor *executor;
+   pthread_t        self = pthread_self();
+   {
+      XrdSysCondVarHelper lock(fCond);
+      executor    = fExecutor;
+      fDelivering = kTRUE;
+      fDeliverer  = self;
+   }
+
+   if (executor) {
+      // The request may be gone as soon as it is posted
+      executor->Post(this);
+      return;
+   }
+
+   Done();
+
+   XrdSysCondVarHelper lock(fCond);
+   if (fDelivering && pthread_equal(fDeliverer, self)) {
+      fDelivering = kFALSE;
+      fInFlight   = kFALSE;
+      fCond.Broadcast();
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Delivered()
+{
+   // Called by an executor when it takes the completed request out of its
+   // queue: the request is not in flight anymore, it may be sent again or
+   // deleted
+
+   XrdSysCondVarHelper lock(fCond);
+   fDelivering = kFALSE;
+   fInFlight   = kFALSE;
+   fCond.Broadcast();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGAsyncRequest::Throttle(XrdCl::File *file)
+{
+   // Get the permission of the rate limiter to send the request to the data
+   // server of the file. A demand request may wait for it; a prefetch which
+   // is refused is aborted with errRetry.
+   //
+   // returns: kTRUE if the request may be sent
+
+   if (!TNetXNGRateLimiter::IsEnabled())
+      return kTRUE;
+
+   std::string host = file->GetDataServer();
+   Long64_t    length;
+   TNetXNGRateLimiter::EPriority priority;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      length   = fLength;
+      priority = fType == kStat ? TNetXNGRateLimiter::kMetadata : fPriority;
+   }
+
+   if (!TNetXNGRateLimiter::Acquire(host.c_str(), length, priority)) {
+      Abort(XrdCl::XRootDStatus(XrdCl::stError, XrdCl::errRetry));
+      return kFALSE;
+   }
+
+   XrdSysCondVarHelper lock(fCond);
+   fHost      = host;
+   fThrottled = kTRUE;
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncRequest::Unthrottle()
+{
+   // Give the grant of the rate limiter back, if the request holds one
+
+   std::string host;
+   Long64_t    length;
+   TNetXNGRateLimiter::EPriority priority;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      if (!fThrottled)
+         return;
+      fThrottled = kFALSE;
+      host.swap(fHost);
+      length   = fLength;
+      priority = fType == kStat ? TNetXNGRateLimiter::kMetadata : fPriority;
+   }
+   TNetXNGRateLimiter::Release(host.c_str(), length, priority);
+}
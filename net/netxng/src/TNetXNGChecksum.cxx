@@ -0,0 +1,389 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGChecksum                                                            //
+//                                                                            //
+// Internal helper of TNetXNGFile computing the adler32 and crc32c checksums  //
+// of a file from the data written to it, in whatever order. The file is     //
+// kept as a list of extents with their checksums, combined in offset order  //
+// at the end. Small extents keep their data so that TFile can patch them    //
+// (headers, directory records); overwriting part of a large extent makes    //
+// the checksums unavailable.                                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGChecksum.h"
+#include "TString.h"
+#include "TMath.h"
+#include "zlib.h"
+#include <cstring>
+
+namespace {
+
+   // Extents up to kMaxKeep bytes keep their data, up to kMaxKeptSize bytes
+   // in total
+   const Long64_t kMaxKeep     = 65536;
+   const Long64_t kMaxKeptSize = 16777216;
+
+   // Castagnoli polynomial, reflected
+   const UInt_t kCrc32cPoly = 0x82f63b78;
+
+   //___________________________________________________________________________
+   // Tables of the software crc32c, processing 8 bytes per step
+   struct TNetXNGCrc32cTables {
+      UInt_t fTable[8][256];
+
+      TNetXNGCrc32cTables()
+      {
+         for (UInt_t i = 0; i < 256; ++i) {
+            UInt_t crc = i;
+            for (Int_t k = 0; k < 8; ++k)
+               crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+            fTable[0][i] = crc;
+         }
+         for (UInt_t i = 0; i < 256; ++i)
+            for (Int_t t = 1; t < 8; ++t)
+               fTable[t][i] = (fTable[t - 1][i] >> 8) ^
+                              fTable[0][fTable[t - 1][i] & 0xff];
+      }
+   } gCrc32cTables;
+
+   //___________________________________________________________________________
+   inline UInt_t Load32(const UChar_t *p)
+   {
+      // Little endian 32 bit word
+
+      return p[0] | (p[1] << 8) | (p[2] << 16) | ((UInt_t) p[3] << 24);
+   }
+
+   //___________________________________________________________________________
+   UInt_t Crc32cSoftware(UInt_t crc, const UChar_t *p, Long64_t length)
+   {
+      // Crc32c, slicing by 8
+
+      const UInt_t (*t)[256] = gCrc32cTables.fTable;
+      for (; length >= 8; p += 8, length -= 8) {
+         UInt_t lo = crc ^ Load32(p);
+         UInt_t hi = Load32(p + 4);
+         crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+               t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+               t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+               t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+      }
+      for (; length > 0; ++p, --length)
+         crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+      return crc;
+   }
+
+#if defined(__GNUC__) && defined(__x86_64__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define R__NETXNG_CRC32C_SSE42
+
+   //___________________________________________________________________________
+   __attribute__((target("sse4.2")))
+   UInt_t Crc32cSSE42(UInt_t crc, const UChar_t *p, Long64_t length)
+   {
+      // Crc32c with the instruction of SSE 4.2, 8 bytes at a time
+
+      for (; length > 0 && ((ULong_t) p & 7); ++p, --length)
+         crc = __builtin_ia32_crc32qi(crc, *p);
+      ULong64_t crc64 = crc;
+      for (; length >= 8; p += 8, length -= 8) {
+         ULong64_t word;
+         memcpy(&word, p, 8);
+         crc64 = __builtin_ia32_crc32di(crc64, word);
+      }
+      crc = (UInt_t) crc64;
+      for (; length > 0; ++p, --length)
+         crc = __builtin_ia32_crc32qi(crc, *p);
+      return crc;
+   }
+
+   //___________________________________________________________________________
+   Bool_t HasSSE42()
+   {
+      // Check if the CPU has the crc32 instruction
+
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse4.2");
+   }
+
+   const Bool_t gHasSSE42 = HasSSE42();
+#endif
+
+   //___________________________________________________________________________
+   UInt_t Gf2Times(const UInt_t *matrix, UInt_t vector)
+   {
+      // Multiply a vector by a matrix over GF(2)
+
+      UInt_t sum = 0;
+      for (; vector; vector >>= 1, ++matrix)
+         if (vector & 1)
+            sum ^= *matrix;
+      return sum;
+   }
+
+   //___________________________________________________________________________
+   void Gf2Square(UInt_t *square, const UInt_t *matrix)
+   {
+      // Square a matrix over GF(2)
+
+      for (Int_t n = 0; n < 32; ++n)
+         square[n] = Gf2Times(matrix, matrix[n]);
+   }
+
+   //___________________________________________________________________________
+   UInt_t Adler32(UInt_t adler, const char *buffer, Long64_t length)
+   {
+      // Adler32 of a buffer of any size (zlib takes an unsigned int)
+
+      while (length > 0) {
+         uInt n = (uInt) TMath::Min(length, (Long64_t) 1073741824);
+         adler = adler32(adler, (const Bytef *) buffer, n);
+         buffer += n;
+         length -= n;
+      }
+      return adler;
+   }
+}
+
+//______________________________________________________________________________
+TNetXNGChecksum::TNetXNGChecksum() : fKeptSize(0), fValid(kTRUE)
+{
+   // Constructor
+}
+
+//______________________________________________________________________________
+UInt_t TNetXNGChecksum::Crc32c(UInt_t crc, const char *buffer,
+                               Long64_t length)
+{
+   // Update a crc32c (iSCSI polynomial, as used by XRootD) with data. Uses
+   // the crc32 instruction of SSE 4.2 where available.
+   //
+   // param crc:    crc32c of the preceding data, 0 to start
+   // param buffer: the data
+   // param length: number of bytes of data
+
+   const UChar_t *p = (const UChar_t *) buffer;
+#ifdef R__NETXNG_CRC32C_SSE42
+   if (gHasSSE42)
+      return ~Crc32cSSE42(~crc, p, length);
+#endif
+   return ~Crc32cSoftware(~crc, p, length);
+}
+
+//______________________________________________________________________________
+UInt_t TNetXNGChecksum::Crc32cCombine(UInt_t crc1, UInt_t crc2,
+                                      Long64_t length2)
+{
+   // Get the crc32c of two blocks of data from their crc32c, as zlib does
+   // for crc32
+   //
+   // param crc1:    crc32c of the first block
+   // param crc2:    crc32c of the second block
+   // param length2: length of the second block
+
+   if (length2 <= 0)
+      return crc1;
+
+   // Operator for one zero bit, then two, then four
+   UInt_t even[32], odd[32];
+   odd[0] = kCrc32cPoly;
+   for (Int_t n = 1; n < 32; ++n)
+      odd[n] = 1U << (n - 1);
+   Gf2Square(even, odd);
+   Gf2Square(odd, even);
+
+   // Apply length2 zero bytes to crc1
+   do {
+      Gf2Square(even, odd);
+      if (length2 & 1)
+         crc1 = Gf2Times(even, crc1);
+      length2 >>= 1;
+      if (!length2)
+         break;
+      Gf2Square(odd, even);
+      if (length2 & 1)
+         crc1 = Gf2Times(odd, crc1);
+      length2 >>= 1;
+   } while (length2);
+
+   return crc1 ^ crc2;
+}
+
+//______________________________________________________________________________
+void TNetXNGChecksum::Update(Long64_t offset, const char *buffer, Int_t length)
+{
+   // Account for data written to the file
+   //
+   // param offset: where the data was written
+   // param buffer: the data
+   // param length: number of bytes written
+
+   XrdSysMutexHelper lock(fMutex);
+   if (!fValid || length <= 0)
+      return;
+   Long64_t end = offset + length;
+
+   // Extents overlapping the write
+   std::map<Long64_t, TExtent>::iterator first = fExtents.upper_bound(offset);
+   if (first != fExtents.begin()) {
+      --first;
+      if (first->first + first->second.fLength <= offset)
+         ++first;
+   }
+   std::map<Long64_t, TExtent>::iterator last = first;
+   Long64_t start = offset, stop = end;
+   for (; last != fExtents.end() && last->first < end; ++last) {
+      const TExtent &extent = last->second;
+      if (!extent.fKept &&
+          (last->first < offset || last->first + extent.fLength > end)) {
+
+         // Part of a large extent is rewritten, its data is gone
+         fValid = kFALSE;
+         fExtents.clear();
+         return;
+      }
+      start = TMath::Min(start, last->first);
+      stop  = TMath::Max(stop, last->first + extent.fLength);
+   }
+
+   if (first == last) {
+      Insert(offset, buffer, length);
+      return;
+   }
+
+   // Rebuild the span of the overlapped extents with the new data
+   std::vector<char> data(stop - start);
+   for (std::map<Long64_t, TExtent>::iterator it = first; it != last; ++it) {
+      if (it->second.fKept && it->second.fLength)
+         memcpy(&data[it->first - start], &it->second.fData[0],
+                it->second.fLength);
+      if (it->second.fKept)
+         fKeptSize -= it->second.fData.size();
+   }
+   memcpy(&data[offset - start], buffer, length);
+   fExtents.erase(first, last);
+   Insert(start, &data[0], data.size());
+}
+
+//______________________________________________________________________________
+void TNetXNGChecksum::Invalidate()
+{
+   // Give the checksums up, e.g. after a failed write: what the server
+   // holds is not known anymore
+
+   XrdSysMutexHelper lock(fMutex);
+   fValid = kFALSE;
+   fExtents.clear();
+   fKeptSize = 0;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGChecksum::IsValid() const
+{
+   // Check if the checksums can still be computed
+
+   XrdSysMutexHelper lock(fMutex);
+   return fValid;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGChecksum::Get(const char *type, TString &value) const
+{
+   // Get the checksum of what was written, as XRootD formats it
+   //
+   // param type:  "adler32" or "crc32c"
+   // param value: the checksum as a hex string (out)
+   // returns:     kFALSE if it cannot be computed: unknown type, part of a
+   //              large extent rewritten, or holes in the file
+
+   UInt_t adler, crc;
+   if (!Combine(adler, crc))
+      return kFALSE;
+
+   TString t(type);
+   t.ToLower();
+   if (t == "adler32")
+      value.Form("%08x", adler);
+   else if (t == "crc32c")
+      value.Form("%08x", crc);
+   else
+      return kFALSE;
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGChecksum::Append(TExtent &extent, const char *buffer,
+                             Long64_t length)
+{
+   // Append data to an extent, with fMutex held
+
+   extent.fAdler   = Adler32(extent.fAdler, buffer, length);
+   extent.fCrc     = Crc32c(extent.fCrc, buffer, length);
+   extent.fLength += length;
+   if (extent.fKept)
+      extent.fData.insert(extent.fData.end(), buffer, buffer + length);
+}
+
+//______________________________________________________________________________
+void TNetXNGChecksum::Insert(Long64_t offset, const char *buffer,
+                             Long64_t length)
+{
+   // Record data written where no extent is, with fMutex held. Data
+   // following a large extent extends it; small data is kept in an extent
+   // of its own while there is room, for TFile to patch it later.
+
+   Bool_t keep = length <= kMaxKeep && fKeptSize + length <= kMaxKeptSize;
+
+   std::map<Long64_t, TExtent>::iterator prev = fExtents.lower_bound(offset);
+   if (prev != fExtents.begin()) {
+      --prev;
+      TExtent &extent = prev->second;
+      if (prev->first + extent.fLength == offset &&
+          (extent.fKept ? extent.fLength + length <= kMaxKeep && keep
+                        : !keep)) {
+         if (extent.fKept)
+            fKeptSize += length;
+         Append(extent, buffer, length);
+         return;
+      }
+   }
+
+   TExtent &extent = fExtents[offset];
+   extent.fKept = keep;
+   if (keep)
+      fKeptSize += length;
+   Append(extent, buffer, length);
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGChecksum::Combine(UInt_t &adler, UInt_t &crc) const
+{
+   // Combine the checksums of the extents, which must cover the file from
+   // its beginning
+
+   XrdSysMutexHelper lock(fMutex);
+   if (!fValid || fExtents.empty())
+      return kFALSE;
+
+   Long64_t end = 0;
+   adler = 1;
+   crc   = 0;
+   std::map<Long64_t, TExtent>::const_iterator it;
+   for (it = fExtents.begin(); it != fExtents.end(); ++it) {
+      if (it->first != end)
+         return kFALSE;
+      adler = adler32_combine(adler, it->second.fAdler, it->second.fLength);
+      crc   = Crc32cCombine(crc, it->second.fCrc, it->second.fLength);
+      end  += it->second.fLength;
+   }
+   return kTRUE;
+}
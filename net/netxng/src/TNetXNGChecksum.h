@@ -0,0 +1,69 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGChecksum
+#define ROOT_TNetXNGChecksum
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGChecksum                                                            //
+//                                                                            //
+// Internal helper of TNetXNGFile computing the adler32 and crc32c checksums  //
+// of a file from the data written to it, in whatever order. The file is     //
+// kept as a list of extents with their checksums, combined in offset order  //
+// at the end. Small extents keep their data so that TFile can patch them    //
+// (headers, directory records); overwriting part of a large extent makes    //
+// the checksums unavailable.                                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include <XrdSys/XrdSysPthread.hh>
+#include <map>
+#include <vector>
+
+class TString;
+
+class TNetXNGChecksum {
+private:
+   struct TExtent {
+      Long64_t          fLength; // Bytes of the extent
+      UInt_t            fAdler;  // Adler32 of the extent
+      UInt_t            fCrc;    // Crc32c of the extent
+      Bool_t            fKept;   // The data is kept in fData
+      std::vector<char> fData;   // Data of a small extent
+
+      TExtent() : fLength(0), fAdler(1), fCrc(0), fKept(kFALSE) {}
+   };
+
+   std::map<Long64_t, TExtent> fExtents;  // Extents written, by offset
+   Long64_t                    fKeptSize; // Bytes of data kept
+   Bool_t                      fValid;    // The checksums can be computed
+   mutable XrdSysMutex         fMutex;    // Protects the members above
+
+public:
+   TNetXNGChecksum();
+
+   void          Update(Long64_t offset, const char *buffer, Int_t length);
+   void          Invalidate();
+   Bool_t        IsValid() const;
+   Bool_t        Get(const char *type, TString &value) const;
+
+   static UInt_t Crc32c(UInt_t crc, const char *buffer, Long64_t length);
+   static UInt_t Crc32cCombine(UInt_t crc1, UInt_t crc2, Long64_t length2);
+
+private:
+   void          Append(TExtent &extent, const char *buffer, Long64_t length);
+   void          Insert(Long64_t offset, const char *buffer, Long64_t length);
+   Bool_t        Combine(UInt_t &adler, UInt_t &crc) const;
+
+   TNetXNGChecksum(const TNetXNGChecksum &other);             // Not implemented
+   TNetXNGChecksum &operator =(const TNetXNGChecksum &other); // Not implemented
+};
+
+#endif // ROOT_TNetXNGChecksum
@@ -0,0 +1,194 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGCompletionQueue                                                     //
+//                                                                            //
+// Collects completed asynchronous requests (see TNetXNGAsyncRequest) for an  //
+// application running its own event loop. The queue owns a descriptor which //
+// is readable as long as completed requests are waiting (an eventfd on       //
+// Linux, a pipe elsewhere), to be registered with poll/epoll; the requests   //
+// are then drained in batches from the loop.                                 //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGCompletionQueue.h"
+#include "TError.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+//______________________________________________________________________________
+TNetXNGCompletionQueue::TNetXNGCompletionQueue() :
+   fHead(0), fTail(0), fSize(0)
+{
+   // Constructor. Check IsValid() for the descriptor to be usable.
+
+   fFD[0] = fFD[1] = -1;
+
+#ifdef __linux__
+   fFD[0] = fFD[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (fFD[0] >= 0)
+      return;
+#endif
+
+   if (pipe(fFD) < 0) {
+      ::SysError("TNetXNGCompletionQueue", "cannot create the descriptor");
+      fFD[0] = fFD[1] = -1;
+      return;
+   }
+   for (Int_t i = 0; i < 2; ++i) {
+      fcntl(fFD[i], F_SETFL, fcntl(fFD[i], F_GETFL) | O_NONBLOCK);
+      fcntl(fFD[i], F_SETFD, FD_CLOEXEC);
+   }
+}
+
+//______________________________________________________________________________
+TNetXNGCompletionQueue::~TNetXNGCompletionQueue()
+{
+   // Destructor. The requests using the queue must be done and drained.
+
+   if (fSize)
+      ::Error("TNetXNGCompletionQueue::~TNetXNGCompletionQueue",
+              "%d completed requests were not drained", fSize);
+
+   if (fFD[0] >= 0)
+      close(fFD[0]);
+   if (fFD[1] >= 0 && fFD[1] != fFD[0])
+      close(fFD[1]);
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGCompletionQueue::GetSize() const
+{
+   // Get the number of completed requests waiting to be drained
+
+   XrdSysMutexHelper lock(fMutex);
+   return fSize;
+}
+
+//______________________________________________________________________________
+void TNetXNGCompletionQueue::Post(TNetXNGAsyncRequest *request)
+{
+   // Queue a completed request; called from an XrdCl thread
+   //
+   // param request: the request, linked through its next pointer
+
+   XrdSysMutexHelper lock(fMutex);
+   request->SetNext(0);
+   if (fTail)
+      fTail->SetNext(request);
+   else
+      fHead = request;
+   fTail = request;
+
+   // The descriptor becomes readable with the first request
+   if (fSize++ == 0)
+      Notify();
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGCompletionQueue::Drain(TNetXNGAsyncRequest **requests, Int_t max)
+{
+   // Take completed requests out of the queue, oldest first, without
+   // blocking. Their Done() method is not called: the caller handles them
+   // and may send them again.
+   //
+   // param requests: array receiving the requests
+   // param max:      size of the array
+   // returns:        the number of requests taken
+
+   Int_t n = 0;
+   {
+      XrdSysMutexHelper lock(fMutex);
+      while (fHead && n < max) {
+         requests[n++] = fHead;
+         fHead = fHead->GetNext();
+         requests[n - 1]->SetNext(0);
+      }
+      if (!fHead)
+         fTail = 0;
+      fSize -= n;
+
+      // The descriptor stays readable as long as requests are waiting
+      if (n && !fSize)
+         Clear();
+   }
+
+   // Out of the queue, they may be sent again
+   for (Int_t i = 0; i < n; ++i)
+      requests[i]->Delivered();
+   return n;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGCompletionQueue::Process(Int_t max)
+{
+   // Drain completed requests and call their Done() method, in the calling
+   // thread
+   //
+   // param max: max number of requests to process, 0 for those queued when
+   //            called
+   // returns:   the number of requests processed
+
+   const Int_t kBatch = 64;
+   TNetXNGAsyncRequest *batch[kBatch];
+
+   Int_t left  = max > 0 ? max : GetSize();
+   Int_t total = 0;
+   while (left > 0) {
+      Int_t n = Drain(batch, left < kBatch ? left : kBatch);
+      if (!n)
+         break;
+      for (Int_t i = 0; i < n; ++i)
+         batch[i]->Done();
+      total += n;
+      left  -= n;
+   }
+   return total;
+}
+
+//______________________________________________________________________________
+void TNetXNGCompletionQueue::Notify()
+{
+   // Make the descriptor readable
+
+   if (fFD[1] < 0)
+      return;
+
+#ifdef __linux__
+   if (fFD[0] == fFD[1]) {
+      eventfd_t one = 1;
+      while (write(fFD[1], &one, sizeof(one)) < 0 && errno == EINTR) { }
+      return;
+   }
+#endif
+   char c = 0;
+   while (write(fFD[1], &c, 1) < 0 && errno == EINTR) { }
+}
+
+//______________________________________________________________________________
+void TNetXNGCompletionQueue::Clear()
+{
+   // Make the descriptor not readable anymore
+
+   if (fFD[0] < 0)
+      return;
+
+   char buffer[64];
+   while (kTRUE) {
+      ssize_t n = read(fFD[0], buffer, sizeof(buffer));
+      if (n > 0 || (n < 0 && errno == EINTR))
+         continue;
+      break;
+   }
+}
@@ -18,21 +18,402 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "TNetXNGFile.h"
+#include "TNetXNGFileMap.h"
+#include "TNetXNGAsyncRequest.h"
+#include "TNetXNGAccessProfile.h"
+#include "TNetXNGChecksum.h"
+#include "TNetXNGTrace.h"
+#include "TNetXNGRateLimiter.h"
+#include "TNetXNGSystem.h"
+#include "TNetXNGInputPipeline.h"
+#include "TNetXNGRace.h"
+#include "TEnv.h"
+#include "TSystem.h"
+#include "TStopwatch.h"
+#include "TMath.h"
+#include "TTimeStamp.h"
+#include "TError.h"
+#include "Bytes.h"
+#include "zlib.h"
 #include <XrdCl/XrdClURL.hh>
 #include <XrdCl/XrdClFile.hh>
+#include <XrdCl/XrdClDefaultEnv.hh>
 #include <XrdCl/XrdClXRootDResponses.hh>
+#include <XProtocol/XProtocol.hh>
+#include <algorithm>
 #include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
 
 ClassImp(TNetXNGFile);
 
+namespace {
+
+   // Readv limits of the XRootD protocol, for use before the actual limits
+   // of the server are known
+   const Int_t kDefaultReadvIorMax = 2097136;
+   const Int_t kDefaultReadvIovMax = 1024;
+
+   // Transport tuning: reads below kMinSplitSize bytes are never split, a
+   // single socket is assumed to carry at most kSocketWindow bytes in flight
+   // (the usual ceiling of the kernel buffer auto-tuning) and the window
+   // found by the auto-tuning is kept within [kMinWindow, kMaxWindow]
+   const Int_t    kMinSplitSize  = 1048576;
+   const Int_t    kSocketWindow  = 4194304;
+   const Int_t    kMinWindow     = 1048576;
+   const Int_t    kMaxWindow     = 268435456;
+   const Int_t    kMaxSubStreams = 16;
+   const Long64_t kSmallRead     = 65536;
+
+   // Largest file read whole into memory when asked explicitly
+   const Long64_t kMaxWholeFile  = 1073741824;
+
+   // Substreams are set up by XrdCl when it creates the channel to a server,
+   // i.e. within the first open to it, from its process-wide environment
+   // (see ConfigureTransport for what this implies). Opens asking for a
+   // given number of substreams share the value they put there for the
+   // duration of the open; an open asking for another value meanwhile does
+   // not wait, and gets the value in place. The lock is only held to change
+   // the value, not across the opens. The auto-tuning results are kept per
+   // data server.
+   XrdSysMutex                  gTransportMutex;
+   std::map<std::string, Int_t> gTunedSubStreams;
+   XrdSysMutex                  gSubStreamsMutex;
+   Int_t                        gSubStreamsValue = 0; // Value put in XrdCl
+   Int_t                        gSubStreamsUsers = 0; // Opens relying on it
+   int                          gSubStreamsSaved = 1; // Value to restore
+
+   //___________________________________________________________________________
+   // Puts a number of substreams in the XrdCl environment for the lifetime
+   // of the object, restoring the previous value once no open needs it.
+   // When other opens set another value, it is left alone.
+   class TNetXNGSubStreamsGuard {
+   private:
+      Int_t fNStreams; // Number of substreams set (0 = untouched)
+
+   public:
+      TNetXNGSubStreamsGuard(Int_t nstreams) : fNStreams(nstreams)
+      {
+         if (fNStreams <= 0)
+            return;
+         XrdSysMutexHelper lock(gSubStreamsMutex);
+         if (gSubStreamsUsers && gSubStreamsValue != fNStreams) {
+            if (gDebug > 0)
+               ::Info("TNetXNGFile", "%d substreams asked for, %d in use by "
+                      "concurrent opens", fNStreams, gSubStreamsValue);
+            fNStreams = 0;
+            return;
+         }
+         if (!gSubStreamsUsers) {
+            XrdCl::Env *env = XrdCl::DefaultEnv::GetEnv();
+            gSubStreamsSaved = 1;
+            env->GetInt("SubStreamsPerChannel", gSubStreamsSaved);
+            env->PutInt("SubStreamsPerChannel", fNStreams);
+            gSubStreamsValue = fNStreams;
+         }
+         ++gSubStreamsUsers;
+      }
+
+      ~TNetXNGSubStreamsGuard()
+      {
+         if (fNStreams <= 0)
+            return;
+         XrdSysMutexHelper lock(gSubStreamsMutex);
+         if (--gSubStreamsUsers == 0)
+            XrdCl::DefaultEnv::GetEnv()->PutInt("SubStreamsPerChannel",
+                                                gSubStreamsSaved);
+      }
+   };
+
+   //___________________________________________________________________________
+   // One read of a parallel copy or of a split read: receives the response
+   // of the asynchronous read, into its own buffer for a copy
+   class TNetXNGReadSlot: public XrdCl::ResponseHandler {
+   public:
+      XrdSysCondVar      *fCond;      // Shared by all the slots of a read
+      std::vector<char>   fBuffer;    // Chunk data (copies only)
+      Long64_t            fOffset;    // Offset of the chunk in the file
+      UInt_t              fLength;    // Requested length
+      UInt_t              fBytesRead; // Length actually read
+      Bool_t              fInFlight;  // A read is outstanding
+      Bool_t              fDone;      // The read has completed
+      XrdCl::XRootDStatus fStatus;    // Status of the read
+      const char         *fHost;      // Data server of the grant of the
+                                      // rate limiter held (copies only)
+
+      TNetXNGReadSlot() : fCond(0), fOffset(0), fLength(0), fBytesRead(0),
+                          fInFlight(kFALSE), fDone(kFALSE), fHost(0) {}
+
+      virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                                  XrdCl::AnyObject    *response)
+      {
+         UInt_t bytesRead = 0;
+         if (status->IsOK() && response) {
+            XrdCl::ChunkInfo *info = 0;
+            response->Get(info);
+            if (info) bytesRead = info->length;
+         }
+         delete response;
+
+         // The bytes are not on the wire anymore
+         if (fHost) {
+            TNetXNGRateLimiter::Release(fHost, fLength,
+                                        TNetXNGRateLimiter::kBulk);
+            fHost = 0;
+         }
+
+         XrdSysCondVarHelper lock(fCond);
+         fStatus    = *status;
+         fBytesRead = bytesRead;
+         fDone      = kTRUE;
+         fCond->Broadcast();
+         delete status;
+      }
+   };
+
+   // Writes held back during Close are sent when this much data is pending
+   const Long64_t kMaxHeldWrites = 16777216;
+
+   // Max writes of a WriteBuffers in flight
+   const Int_t kWriteWindow = 256;
+
+   //___________________________________________________________________________
+   // Receives the responses of a group of asynchronous writes
+   class TNetXNGWriteGroup: public XrdCl::ResponseHandler {
+   private:
+      XrdSysCondVar       fCond;    // Protects what follows
+      Int_t               fPending; // Writes in flight
+      XrdCl::XRootDStatus fStatus;  // First error
+
+   public:
+      TNetXNGWriteGroup() : fCond(0), fPending(0) {}
+
+      virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                                  XrdCl::AnyObject    *response)
+      {
+         XrdSysCondVarHelper lock(fCond);
+         if (!status->IsOK() && fStatus.IsOK())
+            fStatus = *status;
+         --fPending;
+         fCond.Broadcast();
+         delete status;
+         delete response;
+      }
+
+      void Sent()
+      {
+         XrdSysCondVarHelper lock(fCond);
+         ++fPending;
+      }
+
+      XrdCl::XRootDStatus Wait(Int_t maxPending)
+      {
+         // Wait until at most maxPending writes are in flight
+         XrdSysCondVarHelper lock(fCond);
+         while (fPending > maxPending)
+            fCond.Wait();
+         return fStatus;
+      }
+   };
+
+   //___________________________________________________________________________
+   // Closes a file in the background, then deletes it and itself. XrdCl
+   // does not touch the file after calling the handler of its close.
+   class TNetXNGCloseHandler: public XrdCl::ResponseHandler {
+   private:
+      XrdCl::File *fFile; // The file to close, owned
+
+   public:
+      TNetXNGCloseHandler(XrdCl::File *file) : fFile(file) {}
+
+      virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                                  XrdCl::AnyObject    *response)
+      {
+         delete status;
+         delete response;
+         delete fFile;
+         delete this;
+      }
+   };
+
+   //___________________________________________________________________________
+   void SetEntryPoint(XrdCl::URL &url, const std::string &host)
+   {
+      // Point a URL to another entry point, given as host:port
+
+      XrdCl::URL entry(std::string("root://") + host + "/");
+      url.SetHostName(entry.GetHostName());
+      url.SetPort(entry.GetPort());
+   }
+
+   //___________________________________________________________________________
+   // Opens a file through several equivalent entry points at the same time
+   // (see TNetXNGRace); the files opened after the winner are closed in the
+   // background
+   class TNetXNGOpenRace: public TNetXNGRace {
+   private:
+      std::vector<XrdCl::File *> fFiles; // One per entry point
+      std::vector<std::string>   fUrls;  // URL of the file for each of them
+      XrdCl::OpenFlags::Flags    fMode;  // Open mode
+
+   public:
+      TNetXNGOpenRace(const std::vector<std::string> &hosts,
+                      const XrdCl::URL &url, XrdCl::OpenFlags::Flags mode) :
+         TNetXNGRace(hosts), fMode(mode)
+      {
+         for (UInt_t i = 0; i < hosts.size(); ++i) {
+            XrdCl::URL u(url.GetURL());
+            SetEntryPoint(u, hosts[i]);
+            fUrls.push_back(u.GetURL());
+            fFiles.push_back(new XrdCl::File());
+         }
+      }
+
+      XrdCl::File *TakeFile(Int_t i)
+      {
+         // Hand the file opened by the winner over to the caller
+         XrdCl::File *file = fFiles[i];
+         fFiles[i] = 0;
+         return file;
+      }
+
+   protected:
+      virtual ~TNetXNGOpenRace()
+      {
+         for (UInt_t i = 0; i < fFiles.size(); ++i)
+            delete fFiles[i];
+      }
+
+      virtual XrdCl::XRootDStatus Send(Int_t i,
+                                       XrdCl::ResponseHandler *handler)
+      {
+         return fFiles[i]->Open(fUrls[i], fMode, XrdCl::Access::None,
+                                handler);
+      }
+
+      virtual void Lost(Int_t i, const XrdCl::XRootDStatus &status,
+                        XrdCl::AnyObject * /*response*/)
+      {
+         if (!status.IsOK())
+            return;
+         XrdCl::File *file = fFiles[i];
+         fFiles[i] = 0;
+         TNetXNGCloseHandler *handler = new TNetXNGCloseHandler(file);
+         if (!file->Close(handler).IsOK()) {
+            delete handler;
+            delete file;
+         }
+      }
+   };
+
+   //___________________________________________________________________________
+   std::string GetHostName(const std::string &hostId)
+   {
+      // Strip the port from a host:port data server identifier
+
+      std::string::size_type colon = hostId.rfind(':');
+      if (colon == std::string::npos || hostId.find(']') != std::string::npos)
+         return hostId;
+      return hostId.substr(0, colon);
+   }
+
+   //___________________________________________________________________________
+   void CopyProgress(Long64_t bytesread, Long64_t size, TStopwatch &watch)
+   {
+      // Draw the progress bar of a copy
+
+      watch.Stop();
+      Double_t lCopy_time = watch.RealTime();
+      Float_t  rate = (lCopy_time > 0) ? bytesread / lCopy_time / 1048576. : 0;
+      Float_t  percent = (size > 0) ? 100. * bytesread / size : 100.;
+      Int_t    nticks = (Int_t) (percent / 5);
+
+      fprintf(stderr, "[");
+      for (Int_t i = 0; i < 20; i++)
+         fprintf(stderr, "%c", i < nticks ? '>' : '.');
+      fprintf(stderr, "] %.02f %% [%.01f MB/s]\r", percent, rate);
+      watch.Continue();
+   }
+}
+
+//______________________________________________________________________________
+// A file replaced by a recovery, closed in the background right away. A
+// request which got it just before the recovery may still be sent to it and
+// fail, then be sent again on the new file: the XRootD file is deleted once
+// both its close completed and the TNetXNGFile released it.
+class TNetXNGRetiredFile: public XrdCl::ResponseHandler {
+private:
+   XrdSysMutex  fMutex;    // Protects the flags below
+   XrdCl::File *fFile;     // The file replaced, owned
+   Bool_t       fClosed;   // The close completed
+   Bool_t       fReleased; // The TNetXNGFile is done with it
+
+public:
+   TNetXNGRetiredFile(XrdCl::File *file) :
+      fFile(file), fClosed(kFALSE), fReleased(kFALSE) {}
+
+   void Close()
+   {
+      if (!fFile->Close(this).IsOK())
+         Closed();
+   }
+
+   void Release()
+   {
+      Bool_t closed;
+      {
+         XrdSysMutexHelper lock(fMutex);
+         fReleased = kTRUE;
+         closed    = fClosed;
+      }
+      if (closed) {
+         delete fFile;
+         delete this;
+      }
+   }
+
+   virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                               XrdCl::AnyObject    *response)
+   {
+      delete status;
+      delete response;
+      Closed();
+   }
+
+private:
+   void Closed()
+   {
+      Bool_t released;
+      {
+         XrdSysMutexHelper lock(fMutex);
+         fClosed  = kTRUE;
+         released = fReleased;
+      }
+      if (released) {
+         delete fFile;
+         delete this;
+      }
+   }
+};
+
 //______________________________________________________________________________
 TNetXNGFile::TNetXNGFile(const char *url,
                          Option_t   *mode,
                          const char *title,
                          Int_t       compress,
-                         Int_t       /*netopt*/,
+                         Int_t       netopt,
                          Bool_t      parallelopen) :
-   TFile(url, "NET", title, compress)
+   TFile(url, "NET", title, compress), fStatInfo(0), fInitCondVar(0),
+   fReadvIorMax(0), fReadvIovMax(0), fSubStreams(0), fWindow(0),
+   fAutoTune(kFALSE), fMinLatency(0), fBandwidth(0), fNRecoveries(0),
+   fWholeFile(-1), fInMemory(kFALSE), fOpenRequest(0), fOpenStart(0),
+   fProfile(0), fChecksum(0), fBatchWrites(kFALSE), fTraceName(-1),
+   fTraceServer(-1), fTraceFile(0)
 {
    // Constructor
    //
@@ -40,8 +421,78 @@ TNetXNGFile::TNetXNGFile(const char *url,
    // param mode:         initial file access mode
    // param title:        title of the file (shown by ROOT browser)
    // param compress:     compression level and algorithm
-   // param netopt:       TCP window size in bytes (do we need this?)
+   // param netopt:       TCP window size in bytes, i.e. the amount of data a
+   //                     large read keeps in flight, spread over the
+   //                     substreams of the connection (see
+   //                     ConfigureTransport)
    // param parallelopen: open asynchronously (do we need this also?)
+   //
+   // The URL option wholefile=1 has a file opened for reading fetched into
+   // memory at open (see ReadWholeFile), wholefile=0 prevents it.
+   //
+   // If NetXNG.ProfileDir is set, the reads of a file opened for reading
+   // are recorded there at close, and replayed as prefetch when the same
+   // file is opened again (see StartProfile).
+   //
+   // The adler32 and crc32c checksums of a file created are computed as it
+   // is written (see GetWriteChecksum), unless NetXNG.WriteChecksum is 0.
+   // With NetXNG.VerifyChecksum set to 1, they are compared at close with
+   // the checksum computed by the server.
+   //
+   // A file opened for reading which is an input of a TNetXNGInputPipeline
+   // is taken over from the pipeline, already open (see AdoptInput).
+
+   OpenRemote(url, mode, netopt, parallelopen);
+}
+
+//______________________________________________________________________________
+TNetXNGFile::TNetXNGFile(const char          *url,
+                         TNetXNGAsyncRequest *request,
+                         Option_t            *mode,
+                         const char          *title,
+                         Int_t                compress,
+                         Int_t                netopt) :
+   TFile(url, "NET", title, compress), fStatInfo(0), fInitCondVar(0),
+   fReadvIorMax(0), fReadvIovMax(0), fSubStreams(0), fWindow(0),
+   fAutoTune(kFALSE), fMinLatency(0), fBandwidth(0), fNRecoveries(0),
+   fWholeFile(-1), fInMemory(kFALSE), fOpenRequest(request),
+   fOpenStart(0), fProfile(0), fChecksum(0),
+   fBatchWrites(kFALSE), fTraceName(-1), fTraceServer(-1), fTraceFile(0)
+{
+   // Constructor opening the file asynchronously, with the completion of
+   // the open notified through a request (see TNetXNGAsyncRequest): once
+   // it is done, Init() does not wait anymore.
+   //
+   // param url:      URL of the entry-point server to be contacted
+   // param request:  notified when the open completes; must not be in
+   //                 flight
+   // param mode:     initial file access mode
+   // param title:    title of the file (shown by ROOT browser)
+   // param compress: compression level and algorithm
+   // param netopt:   TCP window size in bytes
+
+   if (!request->Start(this, TNetXNGAsyncRequest::kOpen, -1, 0, 1)) {
+      Error("TNetXNGFile", "the request is still in flight");
+      fOpenRequest = 0;
+      fFile = new XrdCl::File();
+      fUrl  = new XrdCl::URL(std::string(url));
+      MakeZombie();
+      return;
+   }
+
+   OpenRemote(url, mode, netopt, kTRUE);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::OpenRemote(const char *url, Option_t *mode, Int_t netopt,
+                             Bool_t parallelopen)
+{
+   // Open the file, for the constructors
+   //
+   // param url:          URL of the entry-point server to be contacted
+   // param mode:         initial file access mode
+   // param netopt:       TCP window size in bytes
+   // param parallelopen: open asynchronously
 
    using namespace XrdCl;
 
@@ -50,25 +501,52 @@ TNetXNGFile::TNetXNGFile(const char *url,
    fUrl->SetProtocol(std::string("root"));
    fMode = ParseOpenMode(mode);
 
+   // Options for the client only, not to be sent to the server
+   URL::ParamsMap params = fUrl->GetParams();
+   URL::ParamsMap::iterator it = params.find("wholefile");
+   if (it != params.end()) {
+      fWholeFile = atoi(it->second.c_str()) ? 1 : 0;
+      params.erase(it);
+      fUrl->SetParams(params);
+   }
+   ConfigureTransport(netopt);
+   TNetXNGTrace::Configure();
+   TNetXNGRateLimiter::Configure();
+
+   if ((fMode == OpenFlags::New || fMode == OpenFlags::Delete) &&
+       gEnv->GetValue("NetXNG.WriteChecksum", 1))
+      fChecksum = new TNetXNGChecksum();
+
    XRootDStatus status;
-   if (!parallelopen) {
+   if (fMode == OpenFlags::Read && AdoptInput()) {
+
+      // Opened ahead by a TNetXNGInputPipeline
+      if (!parallelopen)
+         Init(false);
+      else
+         AsyncOpenDone(status);
+
+   } else if (!parallelopen) {
 
       // Open the file synchronously
-      status = fFile->Open(fUrl->GetURL(), fMode);
+      status = OpenFile();
       if (!status.IsOK()) {
          Error("Open", "%s", status.GetErrorMessage().c_str());
          return;
-      } else
-         TFile::Init(false);
+      } else {
+         UpdateStatInfo();
+         Init(false);
+      }
 
    } else {
 
-      // Open the file asynchronously
+      // Open the file asynchronously; the handler deletes itself
       TNetXNGAsyncOpenHandler *handler = new TNetXNGAsyncOpenHandler(this);
-      fInitCondVar = new XrdSysCondVar();
-      status = fFile->Open(fUrl->GetURL(), fMode, Access::None, handler);
+      status = OpenFile(handler);
       if (!status.IsOK()) {
          Error("Open", "%s", status.GetErrorMessage().c_str());
+         delete handler;
+         AsyncOpenDone(status);
       }
    }
 }
@@ -80,8 +558,15 @@ TNetXNGFile::~TNetXNGFile()
 
    if (IsOpen())
       Close();
+   delete fProfile;
+   delete fChecksum;
    delete fFile;
+   for (UInt_t i = 0; i < fRetired.size(); ++i)
+      fRetired[i]->Release();
+   TNetXNGTrace::ReleaseName(fTraceName);
+   TNetXNGTrace::ReleaseName(fTraceServer);
    delete fUrl;
+   delete fStatInfo;
 }
 
 //______________________________________________________________________________
@@ -96,11 +581,31 @@ void TNetXNGFile::Init(Bool_t create)
    }
 
    // If the async open didn't return yet, wait for it
-   if (!IsOpen()) {
+   fInitCondVar.Lock();
+   while (fAsyncOpenStatus == kAOSInProgress)
       fInitCondVar.Wait();
+   fInitCondVar.UnLock();
+
+   if (!IsOpen()) {
+      Error("Init", "the file is not open");
+      MakeZombie();
+      return;
    }
 
+   // Fetch what TFile::Init is going to read with as few round trips as
+   // possible, then serve its reads from memory. Small files are read
+   // whole and all the reads are served from memory. Nothing is fetched
+   // if a TNetXNGInputPipeline did it already.
+   if (!create && fMode == XrdCl::OpenFlags::Read && fPrefetched.empty() &&
+       !ReadWholeFile())
+      PrefetchInit();
+
    TFile::Init(create);
+   if (!fInMemory)
+      fPrefetched.clear();
+
+   if (!create && fMode == XrdCl::OpenFlags::Read && !fInMemory)
+      StartProfile();
 }
 
 //______________________________________________________________________________
@@ -115,19 +620,80 @@ Long64_t TNetXNGFile::GetSize() const
    if (!IsUseable())
       return -1;
 
+   // The size cannot change under a reader: use the stat of the open
+   if (fStatInfo && fMode == OpenFlags::Read)
+      return fStatInfo->GetSize();
+
    StatInfo *info = 0;
-   fFile->Stat(false, info);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XRootDStatus st = GetXrdFile()->Stat(false, info);
+   if (t0)
+      Trace(TNetXNGTrace::kStat, t0, -1, 0, 1, st.IsOK());
+   if (!st.IsOK() || !info) {
+      Error("GetSize", "%s", st.GetErrorMessage().c_str());
+      delete info;
+      return -1;
+   }
+
    Long64_t size = info->GetSize();
    delete info;
    return size;
 }
 
+//______________________________________________________________________________
+Int_t TNetXNGFile::GetFileStat(FileStat_t &buf) const
+{
+   // Get the stat information of the file as returned by the open, without
+   // contacting the server: size, modification time and flags (e.g. offline
+   // files are flagged as such).
+   //
+   // param buf: structure that will hold the stat info (out)
+   // returns:   0 in case of success, 1 if no stat information is available
+
+   if (!fStatInfo)
+      return 1;
+
+   TNetXNGSystem::FillFileStat(fStatInfo, buf);
+   return 0;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::UpdateStatInfo()
+{
+   // Keep the stat information of the file. XrdCl asks for it with every
+   // open (retstat) and caches it, so this does not cost a round trip
+   // unless the server did not return it.
+
+   XrdCl::StatInfo *info = 0;
+   XrdCl::XRootDStatus st = GetXrdFile()->Stat(false, info);
+   if (!st.IsOK() || !info) {
+      if (gDebug > 0)
+         Info("UpdateStatInfo", "%s", st.GetErrorMessage().c_str());
+      delete info;
+      return;
+   }
+
+   SetStatInfo(info);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::SetStatInfo(XrdCl::StatInfo *info)
+{
+   // Replace the stat information of the file
+   //
+   // param info: the new stat information, owned by the file afterwards
+
+   delete fStatInfo;
+   fStatInfo = info;
+}
+
 //______________________________________________________________________________
 Bool_t TNetXNGFile::IsOpen() const
 {
-   // Check if the file is open
+   // Check if the file is open; a file read whole is open until closed,
+   // although the remote file is closed already
 
-   return fFile->IsOpen();
+   return fInMemory || GetXrdFile()->IsOpen();
 }
 
 //______________________________________________________________________________
@@ -135,20 +701,95 @@ void TNetXNGFile::SetAsyncOpenStatus(EAsyncOpenStatus status)
 {
    // Set the status of an asynchronous file open
 
+   XrdSysCondVarHelper lock(fInitCondVar);
    fAsyncOpenStatus = status;
    // Unblock Init() if it is waiting
-   fInitCondVar.Signal();
+   fInitCondVar.Broadcast();
 }
 
 //______________________________________________________________________________
-void TNetXNGFile::Close(const Option_t */*option*/)
+void TNetXNGFile::AsyncOpenDone(const XrdCl::XRootDStatus &status)
+{
+   // Called when an asynchronous open completed: unblock Init() and notify
+   // the open request, if any. The file may be deleted by the request, so
+   // it must not be touched afterwards.
+   //
+   // param status: the status of the open
+
+   if (fOpenStart)
+      Trace(TNetXNGTrace::kOpen, fOpenStart, -1, 0, 1, status.IsOK());
+   SetAsyncOpenStatus(status.IsOK() ? kAOSSuccess : kAOSFailure);
+
+   TNetXNGAsyncRequest *request = fOpenRequest;
+   fOpenRequest = 0;
+   if (request)
+      request->Complete(status);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::Close(const Option_t *option)
 {
    // Close the file
    //
    // param option: if == "R", all TProcessIDs referenced by this file are
    //               deleted (is this valid in xrootd context?)
+   //
+   // TFile writes its records (directories, keys list, free segments,
+   // header) at scattered offsets, one WriteBuffer at a time: they are held
+   // back and sent together by WriteBuffers.
+
+   if (IsWritable()) {
+      fBatchWrites = kTRUE;
+      TFile::Close(option);
+      fBatchWrites = kFALSE;
+      FlushWrites();
+   } else
+      TFile::Close(option);
+
+   CloseRemote();
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::CloseRemote()
+{
+   // Close the remote file, for Close and ReOpen
+
+   // Store the reads of this job for the next one
+   if (fProfile) {
+      fProfile->Stop();
+      fProfile->Save();
+      if (gDebug > 0)
+         Info("Close", "%lld reads served by the access profile",
+              fProfile->GetNHits());
+      delete fProfile;
+      fProfile = 0;
+   }
+
+   if (fInMemory) {
+      fInMemory = kFALSE;
+      fPrefetched.clear();
+      return;
+   }
 
-   fFile->Close();
+   // The data server, for the checksum, is not known once closed
+   XrdCl::File *file = GetXrdFile();
+   std::string server;
+   if (fChecksum && gEnv->GetValue("NetXNG.VerifyChecksum", 0))
+      server = file->GetDataServer();
+
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XrdCl::XRootDStatus st = file->Close();
+   if (t0)
+      Trace(TNetXNGTrace::kClose, t0, -1, 0, 1, st.IsOK());
+
+   // A re-open may go to another data server
+   {
+      XrdSysMutexHelper lock(fMutex);
+      fTraceFile = 0;
+   }
+
+   if (st.IsOK() && !server.empty())
+      VerifyChecksum(server.c_str());
 }
 
 //______________________________________________________________________________
@@ -177,15 +818,17 @@ Int_t TNetXNGFile::ReOpen(Option_t *modestr)
       return 1;
    }
 
-   fFile->Close();
+   FlushWrites();
+   CloseRemote();
    fMode = mode;
 
-   XRootDStatus st = fFile->Open(fUrl->GetURL(), fMode);
+   XRootDStatus st = OpenFile();
    if (!st.IsOK()) {
       Error("ReOpen", "%s", st.GetErrorMessage().c_str());
       return 1;
    }
 
+   UpdateStatInfo();
    return 0;
 }
 
@@ -198,7 +841,11 @@ Bool_t TNetXNGFile::ReadBuffer(char *buffer, Int_t length)
    // param length: number of bytes to be read
    // returns:      kTRUE in case of failure
 
-   return ReadBuffer(buffer, fOffset, length);
+   if (ReadBuffer(buffer, fOffset, length))
+      return kTRUE;
+
+   fOffset += length;
+   return kFALSE;
 }
 
 //______________________________________________________________________________
@@ -210,6 +857,9 @@ Bool_t TNetXNGFile::ReadBuffer(char *buffer, Long64_t position, Int_t length)
    // param position: offset from the beginning of the file
    // param length:   number of bytes to be read
    // returns:        kTRUE in case of failure
+   //
+   // This may be called from several threads at the same time: it does not
+   // touch the current offset and no lock is held while waiting for data.
 
    using namespace XrdCl;
    if (gDebug > 0)
@@ -219,9 +869,57 @@ Bool_t TNetXNGFile::ReadBuffer(char *buffer, Long64_t position, Int_t length)
    if (!IsUseable())
       return kTRUE;
 
-   // Read the data
+   // Writes held back may cover the data
+   if (!fWritePos.empty() && FlushWrites())
+      return kTRUE;
+
+   // Served from the data prefetched at open
+   if (!fPrefetched.empty() && ReadPrefetched(buffer, position, length))
+      return kFALSE;
+
+   // The whole file is in memory: only part of the range may be in the
+   // file, as for a short read at the end of the file
+   if (fInMemory) {
+      const std::vector<char> &data = fPrefetched.begin()->second;
+      if (position < 0 || position > (Long64_t) data.size()) {
+         Error("ReadBuffer", "offset %lld is out of the file (size %lld)",
+               position, (Long64_t) data.size());
+         return kTRUE;
+      }
+      Long64_t n = TMath::Min((Long64_t) length,
+                              (Long64_t) data.size() - position);
+      if (n > 0)
+         memcpy(buffer, &data[position], n);
+      return kFALSE;
+   }
+
+   // Served from the reads of a previous job replayed ahead
+   if (fProfile) {
+      fProfile->Record(position, length);
+      if (fProfile->Read(buffer, position, length))
+         return kFALSE;
+   }
+
+   // Read the data, spreading large reads over the substreams, and on
+   // another replica if the data server fails. The grant of the rate
+   // limiter is taken per attempt, for the data server actually used, and
+   // not held during a recovery.
+   Double_t start = fAutoTune ? TTimeStamp().AsDouble() : 0;
+   Double_t deadline = 0;
    uint32_t bytesRead = 0;
-   XRootDStatus st = fFile->Read(position, length, buffer, bytesRead);
+   XRootDStatus st;
+   File *file;
+   do {
+      file = GetXrdFile();
+      TNetXNGRateGuard guard(file, length);
+      Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+      if (fSubStreams > 1 && length >= 2 * kMinSplitSize)
+         st = ReadSplit(file, buffer, position, length, bytesRead);
+      else
+         st = file->Read(position, length, buffer, bytesRead);
+      if (t0)
+         Trace(TNetXNGTrace::kRead, t0, position, length, 1, st.IsOK(), file);
+   } while (!st.IsOK() && Recover(file, st, deadline));
    if (gDebug > 0)
       Info("ReadBuffer", "%s bytes read: %d", st.ToStr().c_str(), bytesRead);
 
@@ -230,13 +928,11 @@ Bool_t TNetXNGFile::ReadBuffer(char *buffer, Long64_t position, Int_t length)
       return kTRUE;
    }
 
-   // Bump the globals
-   fOffset     += length;
-   fBytesRead  += bytesRead;
-   fgBytesRead += bytesRead;
-   fReadCalls  ++;
-   fgReadCalls ++;
+   if (fAutoTune)
+      TuneTransport(bytesRead, TTimeStamp().AsDouble() - start);
 
+   // Bump the globals
+   BumpReadCounters(bytesRead);
    return kFALSE;
 }
 
@@ -254,6 +950,8 @@ Bool_t TNetXNGFile::ReadBuffers(char *buffer, Long64_t *position, Int_t *length,
    //                 position[i]
    // param nbuffs:   number of chunks
    // returns:        kTRUE in case of failure
+   //
+   // This may be called from several threads at the same time.
 
    using namespace XrdCl;
 
@@ -261,22 +959,75 @@ Bool_t TNetXNGFile::ReadBuffers(char *buffer, Long64_t *position, Int_t *length,
    if (!IsUseable())
       return kTRUE;
 
-   // Find the max size for a single readv buffer
-   URL url(fFile->GetDataServer());
-   FileSystem fs(url);
-   Buffer arg;
-   Buffer *response;
-   arg.FromString(std::string("readv_ior_max"));
-
-   XRootDStatus status = fs.Query(QueryCode::Config, arg, response);
-   if (!status.IsOK()) {
-      Error("ReadBuffers", "%s", status.GetErrorMessage().c_str());
+   // Writes held back may cover the data
+   if (!fWritePos.empty() && FlushWrites())
       return kTRUE;
+
+   // The whole file is in memory
+   if (fInMemory) {
+      for (Int_t i = 0; i < nbuffs; buffer += length[i], ++i)
+         if (ReadBuffer(buffer, position[i], length[i]))
+            return kTRUE;
+      return kFALSE;
    }
 
-   Int_t maxRead = TString(response->ToString()).Remove(response->GetSize() - 1)
-                           .Atoi();
-   delete response;
+   if (!fProfile)
+      return ReadVector(buffer, position, length, nbuffs);
+
+   // Serve the chunks from the reads of a previous job replayed ahead; the
+   // others are read at once, then moved in place
+   std::vector<Long64_t> missPosition;
+   std::vector<Int_t>    missLength;
+   std::vector<char *>   missBuffer;
+   Long64_t              missBytes = 0;
+   char *cursor = buffer;
+   for (Int_t i = 0; i < nbuffs; cursor += length[i], ++i) {
+      fProfile->Record(position[i], length[i]);
+      if (fProfile->Read(cursor, position[i], length[i]))
+         continue;
+      missPosition.push_back(position[i]);
+      missLength.push_back(length[i]);
+      missBuffer.push_back(cursor);
+      missBytes += length[i];
+   }
+
+   if (missPosition.empty())
+      return kFALSE;
+   if ((Int_t) missPosition.size() == nbuffs)
+      return ReadVector(buffer, position, length, nbuffs);
+
+   std::vector<char> data(missBytes);
+   if (ReadVector(&data[0], &missPosition[0], &missLength[0],
+                  missPosition.size()))
+      return kTRUE;
+
+   cursor = &data[0];
+   for (UInt_t i = 0; i < missPosition.size(); cursor += missLength[i], ++i)
+      memcpy(missBuffer[i], cursor, missLength[i]);
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::ReadVector(char *buffer, Long64_t *position, Int_t *length,
+                               Int_t nbuffs)
+{
+   // Read scattered data chunks from the server, for ReadBuffers
+   //
+   // param buffer:   a pointer to a buffer big enough to hold all of the
+   //                 requested data
+   // param position: position[i] is the seek position of chunk i of len
+   //                 length[i]
+   // param length:   length[i] is the length of the chunk at offset
+   //                 position[i]
+   // param nbuffs:   number of chunks
+   // returns:        kTRUE in case of failure
+
+   using namespace XrdCl;
+
+   // Find the max size for a single readv buffer
+   Int_t maxRead, maxChunks;
+   if (!GetVectorReadLimits(maxRead, maxChunks))
+      return kTRUE;
 
    // Build a list of chunks
    ChunkList chunks;
@@ -290,28 +1041,57 @@ Bool_t TNetXNGFile::ReadBuffers(char *buffer, Long64_t *position, Int_t *length,
 
          for (j = 0; j < nsplit; ++j)
             chunks.push_back(ChunkInfo(position[i] + (j * maxRead), maxRead));
-         chunks.push_back(ChunkInfo(position[i] + (j * maxRead), rem));
+         if (rem)
+            chunks.push_back(ChunkInfo(position[i] + (j * maxRead), rem));
       } else
          chunks.push_back(ChunkInfo(position[i], length[i]));
    }
 
-   // Read the data
-   VectorReadInfo *info = 0;
-   XRootDStatus st = fFile->VectorRead(chunks, (void *) buffer, info);
+   // Read the data, in as many requests as the server chunk limit imposes;
+   // the data of each request follows that of the previous one. Requests
+   // failing with the data server are sent again to another replica.
+   char    *cursor = buffer;
+   Double_t deadline = 0;
+   for (UInt_t first = 0; first < chunks.size(); first += maxChunks) {
+      UInt_t last = TMath::Min((UInt_t) chunks.size(), first + maxChunks);
+      ChunkList batch(chunks.begin() + first, chunks.begin() + last);
+      Long64_t bytes = 0;
+      for (UInt_t i = 0; i < batch.size(); ++i)
+         bytes += batch[i].length;
+
+      Double_t start = fAutoTune ? TTimeStamp().AsDouble() : 0;
+      VectorReadInfo *info = 0;
+      XRootDStatus st;
+      File *file;
+      do {
+         delete info;
+         info = 0;
+         file = GetXrdFile();
+         TNetXNGRateGuard guard(file, bytes);
+         Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+         st = file->VectorRead(batch, (void *) cursor, info);
+         if (t0)
+            Trace(TNetXNGTrace::kVectorRead, t0, batch[0].offset, bytes,
+                  batch.size(), st.IsOK(), file);
+      } while (!st.IsOK() && Recover(file, st, deadline));
+
+      if (!st.IsOK()) {
+         Error("ReadBuffers", "%s", st.GetErrorMessage().c_str());
+         delete info;
+         return kTRUE;
+      }
 
-   if (!st.IsOK()) {
-      Error("ReadBuffers", "%s", st.GetErrorMessage().c_str());
+      if (fAutoTune)
+         TuneTransport(info->GetSize(), TTimeStamp().AsDouble() - start);
+
+      // Bump the globals
+      BumpReadCounters(info->GetSize());
       delete info;
-      return kTRUE;
-   }
 
-   // Bump the globals
-   fBytesRead  += info->GetSize();
-   fgBytesRead += info->GetSize();
-   fReadCalls  ++;
-   fgReadCalls ++;
+      for (UInt_t i = 0; i < batch.size(); ++i)
+         cursor += batch[i].length;
+   }
 
-   delete info;
    return kFALSE;
 }
 
@@ -330,88 +1110,1841 @@ Bool_t TNetXNGFile::WriteBuffer(const char *buffer, Int_t length)
    if (!IsUseable())
       return kTRUE;
 
+   // Held back, appended to the previous write if it ends here; a write
+   // overlapping one held back has to go after it
+   if (fBatchWrites) {
+      Bool_t overlap = kFALSE;
+      for (UInt_t i = 0; i < fWritePos.size() && !overlap; ++i)
+         overlap = fOffset < fWritePos[i] + fWriteLen[i] &&
+                   fWritePos[i] < fOffset + length;
+      if (overlap && FlushWrites())
+         return kTRUE;
+
+      if (!fWritePos.empty() &&
+          fWritePos.back() + fWriteLen.back() == fOffset &&
+          (Long64_t) fWriteLen.back() + length <= kMaxHeldWrites)
+         fWriteLen.back() += length;
+      else {
+         fWritePos.push_back(fOffset);
+         fWriteLen.push_back(length);
+      }
+      fWriteData.insert(fWriteData.end(), buffer, buffer + length);
+      fOffset += length;
+      ++fWritten;
+
+      if ((Long64_t) fWriteData.size() >= kMaxHeldWrites)
+         return FlushWrites();
+      return kFALSE;
+   }
+
    // Write the data
-   XRootDStatus st = fFile->Write(fOffset, length, buffer);
+   File *file = GetXrdFile();
+   TNetXNGRateGuard guard(file, length);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XRootDStatus st = file->Write(fOffset, length, buffer);
+   if (t0)
+      Trace(TNetXNGTrace::kWrite, t0, fOffset, length, 1, st.IsOK());
    if (!st.IsOK()) {
       Error("WriteBuffer", "%s", st.GetErrorMessage().c_str());
+      WriteFailed();
       return kTRUE;
    }
 
+   if (fChecksum)
+      fChecksum->Update(fOffset, buffer, length);
+
    // Bump the globals
-   fOffset      += length;
-   fBytesWrite  += length;
-   fgBytesWrite += length;
+   fOffset += length;
+   ++fWritten;
+   BumpWriteCounters(length);
 
    return kFALSE;
 }
 
 //______________________________________________________________________________
-void TNetXNGFile::Seek(Long64_t offset, ERelativeTo position)
-{
-   // Set the position within the file
-   //
-   // param offset:   the new offset relative to position
-   // param position: the relative position, either kBeg, kCur or kEnd
-
-   SetOffset(offset, position);
-}
-
-//______________________________________________________________________________
-XrdCl::OpenFlags::Flags TNetXNGFile::ParseOpenMode(Option_t *modestr)
+Bool_t TNetXNGFile::WriteBuffers(const char *buffer, Long64_t *position,
+                                 Int_t *length, Int_t nbuffs)
 {
-   // Parse an file open mode given as a string into an integer that the
-   // client can use
+   // Write scattered data chunks in one operation: the writes are sent
+   // without waiting for each other, then all of them are waited for, so
+   // that they cost about one round trip. The server may apply them in any
+   // order, hence overlapping chunks are first merged into disjoint
+   // extents, the data of the later chunk winning.
    //
-   // param option: the file open mode as a string
-   // returns:      correctly parsed option mode
+   // param buffer:   the data of all the chunks, one after the other
+   // param position: position[i] is the offset of chunk i of len length[i]
+   // param length:   length[i] is the length of the chunk at offset
+   //                 position[i]
+   // param nbuffs:   number of chunks
+   // returns:        kTRUE in case of failure
 
    using namespace XrdCl;
-   OpenFlags::Flags mode = OpenFlags::None;
-   TString mod = ToUpper(TString(modestr));
 
-   if (mod == "NEW" || mod == "CREATE")  mode = OpenFlags::New;
-   else if (mod == "RECREATE")           mode = OpenFlags::Delete;
-   else if (mod == "UPDATE")             mode = OpenFlags::Update;
-   else if (mod == "READ")               mode = OpenFlags::Read;
+   // Check the file isn't a zombie or closed
+   if (!IsUseable())
+      return kTRUE;
 
-   return mode;
-}
+   // Sort the chunks by offset to look for overlaps
+   std::vector<std::pair<Long64_t, Int_t> > order;
+   std::vector<Long64_t> start(nbuffs + 1, 0);
+   for (Int_t i = 0; i < nbuffs; ++i) {
+      start[i + 1] = start[i] + length[i];
+      if (length[i])
+         order.push_back(std::make_pair(position[i], i));
+   }
+   Long64_t total = start[nbuffs];
+   if (!total)
+      return kFALSE;
 
-//______________________________________________________________________________
-Bool_t TNetXNGFile::IsUseable() const
-{
-   // Check the file is open and isn't a zombie
+   std::sort(order.begin(), order.end());
+   Bool_t   overlap = kFALSE;
+   Long64_t end     = order[0].first;
+   for (UInt_t k = 0; k < order.size() && !overlap; ++k) {
+      Int_t i = order[k].second;
+      overlap = position[i] < end;
+      end = TMath::Max(end, position[i] + length[i]);
+   }
 
-   if (IsZombie()) {
-      Error("TNetXNGFile", "Object is in 'zombie' state");
-      return kFALSE;
+   // Merge the overlapping chunks into extents, then copy the chunks into
+   // them in their original order so that the later data wins
+   if (overlap) {
+      std::vector<Long64_t> extPos;
+      std::vector<Int_t>    extLen;
+      std::vector<Long64_t> extStart;
+      std::vector<Int_t>    extent(nbuffs, 0);
+      Long64_t              size = 0;
+      for (UInt_t k = 0; k < order.size(); ++k) {
+         Int_t i = order[k].second;
+         if (extPos.empty() || position[i] >= extPos.back() + extLen.back()) {
+            if (!extLen.empty())
+               size += extLen.back();
+            extPos.push_back(position[i]);
+            extLen.push_back(length[i]);
+            extStart.push_back(size);
+         } else
+            extLen.back() = TMath::Max((Long64_t) extLen.back(),
+                                       position[i] + length[i] -
+                                       extPos.back());
+         extent[i] = extPos.size() - 1;
+      }
+      size += extLen.back();
+
+      std::vector<char> data(size);
+      for (Int_t i = 0; i < nbuffs; ++i) {
+         if (!length[i])
+            continue;
+         Int_t j = extent[i];
+         memcpy(&data[extStart[j] + position[i] - extPos[j]],
+                buffer + start[i], length[i]);
+      }
+      return WriteBuffers(&data[0], &extPos[0], &extLen[0], extPos.size());
    }
 
-   if (!IsOpen()) {
-      Error("TNetXNGFile", "The remote file is not open");
-      return kFALSE;
+   File             *file = GetXrdFile();
+   TNetXNGRateGuard  guard(file, total);
+   TNetXNGWriteGroup group;
+   XRootDStatus      st;
+   const char       *cursor = buffer;
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   for (Int_t i = 0; i < nbuffs; cursor += length[i], ++i) {
+      if (!length[i])
+         continue;
+      st = group.Wait(kWriteWindow - 1);
+      if (!st.IsOK())
+         break;
+
+      group.Sent();
+      st = file->Write(position[i], length[i], cursor, &group);
+      if (!st.IsOK()) {
+         group.HandleResponse(new XRootDStatus(st), 0);
+         break;
+      }
+      if (fChecksum)
+         fChecksum->Update(position[i], cursor, length[i]);
    }
+   XRootDStatus last = group.Wait(0);
+   if (st.IsOK())
+      st = last;
+   if (t0)
+      Trace(TNetXNGTrace::kWrite, t0, position[0], total, nbuffs, st.IsOK());
 
-   return kTRUE;
+   if (!st.IsOK()) {
+      Error("WriteBuffers", "%s", st.GetErrorMessage().c_str());
+      WriteFailed();
+      return kTRUE;
+   }
+
+   // Bump the globals
+   ++fWritten;
+   BumpWriteCounters(total);
+   return kFALSE;
 }
 
 //______________________________________________________________________________
-TNetXNGAsyncOpenHandler::TNetXNGAsyncOpenHandler(TNetXNGFile *file)
+Bool_t TNetXNGFile::FlushWrites()
 {
-   fFile = file;
-   fFile->SetAsyncOpenStatus(TFile::kAOSInProgress);
+   // Send the writes held back during Close
+   //
+   // returns: kTRUE in case of failure
+
+   if (fWritePos.empty())
+      return kFALSE;
+
+   std::vector<char>     data;
+   std::vector<Long64_t> position;
+   std::vector<Int_t>    length;
+   data.swap(fWriteData);
+   position.swap(fWritePos);
+   length.swap(fWriteLen);
+   return WriteBuffers(&data[0], &position[0], &length[0], position.size());
 }
 
 //______________________________________________________________________________
-void TNetXNGAsyncOpenHandler::HandleResponse(XrdCl::XRootDStatus *status,
-                                             XrdCl::AnyObject    *response)
+Int_t TNetXNGFile::SysSync(Int_t /*fd*/)
 {
-   // Called when a response to associated request arrives or an error occurs
-   delete response;
-   if (status->IsOK()) {
-      fFile->SetAsyncOpenStatus(TFile::kAOSSuccess);
-   } else {
-      fFile->SetAsyncOpenStatus(TFile::kAOSFailure);
-   }
+   // Have the data server flush the file, for TFile::Flush, after the
+   // writes held back are sent. TFile::Flush only calls it once something
+   // was written, which the writes count in fWritten; Close flushes too,
+   // hence costs a kXR_sync for files that were written.
+   //
+   // returns: 0 in case of success, -1 otherwise
 
+   if (!IsUseable() || fInMemory)
+      return 0;
+
+   if (FlushWrites())
+      return -1;
+
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XrdCl::XRootDStatus st = GetXrdFile()->Sync();
+   if (t0)
+      Trace(TNetXNGTrace::kSync, t0, -1, 0, 1, st.IsOK());
+   if (!st.IsOK()) {
+      Error("SysSync", "%s", st.GetErrorMessage().c_str());
+      return -1;
+   }
+   return 0;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::ReadAsync(TNetXNGAsyncRequest *request, char *buffer,
+                              Long64_t position, Int_t length)
+{
+   // Read a data chunk asynchronously. The buffer must stay valid until the
+   // request is done; request->Done() is then called (see
+   // TNetXNGAsyncRequest). Unlike ReadBuffer, failures of the data server
+   // are not recovered from.
+   //
+   // param request:  the request to use, which must not be in flight
+   // param buffer:   a pointer to a buffer big enough to hold the data
+   // param position: offset from the beginning of the file
+   // param length:   number of bytes to be read
+   // returns:        kTRUE if the request could not be sent, in which case
+   //                 Done() is not called; prefetches may be refused by
+   //                 the rate limiter (see TNetXNGAsyncRequest::SetPriority)
+
+   using namespace XrdCl;
+
+   if (!IsUseable())
+      return kTRUE;
+
+   if (!request->Start(this, TNetXNGAsyncRequest::kRead, position, length,
+                       1)) {
+      Error("ReadAsync", "the request is still in flight");
+      return kTRUE;
+   }
+
+   if (fInMemory) {
+      ReadBuffer(buffer, position, length);
+      request->Served(TMath::Max(0LL, TMath::Min((Long64_t) length,
+                                                 GetSize() - position)));
+      return kFALSE;
+   }
+
+   File *file = GetXrdFile();
+   if (!request->Throttle(file))
+      return kTRUE;
+
+   XRootDStatus st = file->Read(position, length, buffer, request);
+   if (!st.IsOK()) {
+      Error("ReadAsync", "%s", st.GetErrorMessage().c_str());
+      request->Abort(st);
+      return kTRUE;
+   }
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::ReadBuffersAsync(TNetXNGAsyncRequest *request,
+                                     char *buffer, Long64_t *position,
+                                     Int_t *length, Int_t nbuffs)
+{
+   // Read scattered data chunks asynchronously, into consecutive parts of
+   // the buffer as ReadBuffers does. The server limits are those cached by
+   // the file: the first vector read of a file may have to query them.
+   //
+   // param request:  the request to use, which must not be in flight
+   // param buffer:   a pointer to a buffer big enough to hold all of the
+   //                 requested data
+   // param position: position[i] is the seek position of chunk i of len
+   //                 length[i]
+   // param length:   length[i] is the length of the chunk at offset
+   //                 position[i]
+   // param nbuffs:   number of chunks
+   // returns:        kTRUE if the request could not be sent, in which case
+   //                 Done() is not called; prefetches may be refused by
+   //                 the rate limiter (see TNetXNGAsyncRequest::SetPriority)
+
+   using namespace XrdCl;
+
+   if (!IsUseable())
+      return kTRUE;
+
+   // Build the list of chunks in the request, whose storage is reused
+   Long64_t total = 0;
+   for (Int_t i = 0; i < nbuffs; ++i)
+      total += length[i];
+   if (!request->Start(this, TNetXNGAsyncRequest::kVectorRead,
+                       nbuffs ? position[0] : -1, total, 0)) {
+      Error("ReadBuffersAsync", "the request is still in flight");
+      return kTRUE;
+   }
+
+   if (fInMemory) {
+      ReadBuffers(buffer, position, length, nbuffs);
+      request->Served(total);
+      return kFALSE;
+   }
+
+   Int_t maxRead, maxChunks;
+   if (!GetVectorReadLimits(maxRead, maxChunks)) {
+      request->Abort(XRootDStatus(stError, errUnknown));
+      return kTRUE;
+   }
+
+   ChunkList &chunks = request->fChunks;
+   chunks.clear();
+   for (Int_t i = 0; i < nbuffs; ++i) {
+      for (Int_t done = 0; done < length[i]; done += maxRead)
+         chunks.push_back(ChunkInfo(position[i] + done,
+                                    TMath::Min(maxRead, length[i] - done)));
+   }
+
+   Int_t nbatches = ((Int_t) chunks.size() + maxChunks - 1) / maxChunks;
+   if (!nbatches) {
+      request->Abort(XRootDStatus());
+      return kTRUE;
+   }
+   {
+      XrdSysCondVarHelper lock(request->fCond);
+      request->fPending = nbatches;
+   }
+
+   File *file = GetXrdFile();
+   if (!request->Throttle(file))
+      return kTRUE;
+
+   // Send as many requests as the server chunk limit imposes; the data of
+   // each one follows that of the previous one
+   char *cursor = buffer;
+   for (Int_t b = 0; b < nbatches; ++b) {
+      UInt_t first = b * maxChunks;
+      UInt_t last  = TMath::Min((UInt_t) chunks.size(), first + maxChunks);
+
+      XRootDStatus st;
+      if (nbatches == 1)
+         st = file->VectorRead(chunks, (void *) cursor, request);
+      else
+         st = file->VectorRead(ChunkList(chunks.begin() + first,
+                                         chunks.begin() + last),
+                               (void *) cursor, request);
+
+      if (!st.IsOK()) {
+         Error("ReadBuffersAsync", "%s", st.GetErrorMessage().c_str());
+         if (!b) {
+            request->Abort(st);
+            return kTRUE;
+         }
+         request->Fail(st, nbatches - b);
+         break;
+      }
+
+      for (UInt_t i = first; i < last; ++i)
+         cursor += chunks[i].length;
+   }
+
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::StatAsync(TNetXNGAsyncRequest *request)
+{
+   // Get the stat information of the file from the server asynchronously;
+   // see TNetXNGAsyncRequest::GetFileStat
+   //
+   // param request: the request to use, which must not be in flight
+   // returns:       kTRUE if the request could not be sent, in which case
+   //                Done() is not called
+
+   using namespace XrdCl;
+
+   if (!IsUseable())
+      return kTRUE;
+
+   if (!request->Start(this, TNetXNGAsyncRequest::kStat, -1, 0, 1)) {
+      Error("StatAsync", "the request is still in flight");
+      return kTRUE;
+   }
+
+   // The remote file is closed already, what it was opened with holds
+   if (fInMemory) {
+      request->Complete(XRootDStatus(),
+                        fStatInfo ? new StatInfo(*fStatInfo) : 0);
+      return kFALSE;
+   }
+
+   File *file = GetXrdFile();
+   if (!request->Throttle(file))
+      return kTRUE;
+
+   XRootDStatus st = file->Stat(true, request);
+   if (!st.IsOK()) {
+      Error("StatAsync", "%s", st.GetErrorMessage().c_str());
+      request->Abort(st);
+      return kTRUE;
+   }
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::WriteAsync(TNetXNGAsyncRequest *request,
+                               const char *buffer, Long64_t position,
+                               Int_t length)
+{
+   // Write a data chunk asynchronously. The buffer must stay valid until
+   // the request is done.
+   //
+   // param request:  the request to use, which must not be in flight
+   // param buffer:   the data to be written
+   // param position: offset from the beginning of the file
+   // param length:   the size of the buffer
+   // returns:        kTRUE if the request could not be sent, in which case
+   //                 Done() is not called; prefetches may be refused by
+   //                 the rate limiter (see TNetXNGAsyncRequest::SetPriority)
+
+   using namespace XrdCl;
+
+   if (!IsUseable())
+      return kTRUE;
+
+   if (!request->Start(this, TNetXNGAsyncRequest::kWrite, position, length,
+                       1)) {
+      Error("WriteAsync", "the request is still in flight");
+      return kTRUE;
+   }
+
+   File *file = GetXrdFile();
+   if (!request->Throttle(file))
+      return kTRUE;
+
+   // The buffer is only guaranteed to be valid until the request is done:
+   // the checksums are updated now, and given up if the write fails
+   if (fChecksum)
+      fChecksum->Update(position, buffer, length);
+
+   XRootDStatus st = file->Write(position, length, buffer, request);
+   if (!st.IsOK()) {
+      Error("WriteAsync", "%s", st.GetErrorMessage().c_str());
+      WriteFailed();
+      request->Abort(st);
+      return kTRUE;
+   }
+   ++fWritten;
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::Seek(Long64_t offset, ERelativeTo position)
+{
+   // Set the position within the file
+   //
+   // param offset:   the new offset relative to position
+   // param position: the relative position, either kBeg, kCur or kEnd
+
+   SetOffset(offset, position);
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::Cp(const char *dst, Bool_t progressbar, UInt_t buffersize)
+{
+   // Copy the file to a local destination. Several chunks are read
+   // asynchronously at the same time and streamed to disk in order, so that
+   // an interrupted copy leaves a valid prefix behind. If the server
+   // provides an adler32 checksum, an existing partial destination is
+   // resumed and the result is verified against it. Non-local destinations
+   // are handled by TFile::Cp.
+   //
+   // The number of chunks in flight is set by NetXNG.CopyParallelChunks
+   // (default 8).
+   //
+   // param dst:         the destination path; if it is a directory, the
+   //                    name of the source file is appended
+   // param progressbar: show the progress of the copy
+   // param buffersize:  size of a single chunk
+   // returns:           kTRUE in case of success
+
+   TUrl dURL(dst, kTRUE);
+   if (strcmp(dURL.GetProtocol(), "file"))
+      return TFile::Cp(dst, progressbar, buffersize);
+
+   // Check the file isn't a zombie or closed
+   if (!IsUseable())
+      return kFALSE;
+
+   TString path = dURL.GetFile();
+   FileStat_t dstStat;
+   if (!gSystem->GetPathInfo(path, dstStat) && R_ISDIR(dstStat.fMode)) {
+      path += "/";
+      path += gSystem->BaseName(fUrl->GetPath().c_str());
+   }
+
+   // A file held in memory is closed on the server: write it out as is
+   if (fInMemory) {
+      const std::vector<char> &data = fPrefetched.begin()->second;
+      Int_t fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+         SysError("Cp", "cannot open %s", path.Data());
+         return kFALSE;
+      }
+      Long64_t done = 0;
+      while (done < (Long64_t) data.size()) {
+         ssize_t n = write(fd, &data[done], data.size() - done);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0) {
+            SysError("Cp", "cannot write %s", path.Data());
+            close(fd);
+            return kFALSE;
+         }
+         done += n;
+      }
+      if (close(fd) < 0) {
+         SysError("Cp", "cannot close %s", path.Data());
+         return kFALSE;
+      }
+      return kTRUE;
+   }
+
+   Long64_t size = GetSize();
+   if (size < 0) {
+      Error("Cp", "cannot get the size of the file");
+      return kFALSE;
+   }
+
+   // Without a checksum to check against, a partial destination cannot be
+   // trusted and the copy starts from scratch
+   TString ckType, ckValue;
+   Bool_t verify = GetServerChecksum(ckType, ckValue) && ckType == "adler32";
+   if (!verify && gDebug > 0)
+      Info("Cp", "no adler32 checksum available, not verifying the copy");
+
+   Int_t    nslots    = TMath::Max(1, gEnv->GetValue("NetXNG.CopyParallelChunks",
+                                                     8));
+   Long64_t chunkSize = buffersize ? buffersize : 1000000;
+   Long64_t start     = 0;
+   if (verify && !gSystem->GetPathInfo(path, dstStat)
+              && dstStat.fSize > 0 && dstStat.fSize <= size)
+      start = dstStat.fSize;
+
+   for (Int_t attempt = 0; attempt < 2; ++attempt) {
+      Int_t fd = open(path, O_RDWR | O_CREAT | (start ? 0 : O_TRUNC), 0644);
+      if (fd < 0) {
+         SysError("Cp", "cannot open %s", path.Data());
+         return kFALSE;
+      }
+
+      // Checksum the part already there
+      ULong_t checksum = adler32(0L, Z_NULL, 0);
+      if (start) {
+         if (gDebug > 0)
+            Info("Cp", "resuming copy to %s at offset %lld", path.Data(),
+                 start);
+         std::vector<char> buffer(chunkSize);
+         for (Long64_t off = 0; off < start; ) {
+            ssize_t n = pread(fd, &buffer[0],
+                              TMath::Min(chunkSize, start - off), off);
+            if (n <= 0) {
+               SysError("Cp", "cannot read back %s", path.Data());
+               close(fd);
+               return kFALSE;
+            }
+            checksum = adler32(checksum, (const Bytef *) &buffer[0], n);
+            off += n;
+         }
+      }
+
+      Int_t rc = CpChunks(fd, start, size, nslots, chunkSize, progressbar,
+                          checksum);
+      if (!rc && ftruncate(fd, size) < 0) {
+         SysError("Cp", "cannot truncate %s", path.Data());
+         rc = -1;
+      }
+      if (close(fd) < 0) {
+         SysError("Cp", "cannot close %s", path.Data());
+         rc = -1;
+      }
+      if (rc)
+         return kFALSE;
+
+      if (!verify)
+         return kTRUE;
+
+      if (strtoul(ckValue.Data(), 0, 16) == checksum)
+         return kTRUE;
+
+      // A resumed copy may have started from a stale file: try once more
+      // from scratch
+      Error("Cp", "adler32 mismatch for %s: expected %s, got %08lx",
+            path.Data(), ckValue.Data(), checksum);
+      if (!start)
+         return kFALSE;
+      start = 0;
+   }
+
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGFile::CpChunks(Int_t fd, Long64_t start, Long64_t size,
+                            Int_t nslots, Long64_t chunkSize,
+                            Bool_t progressbar, ULong_t &checksum)
+{
+   // Copy a range of the file to a local descriptor, keeping several chunk
+   // reads in flight. Chunks are issued round-robin over the slots and
+   // written in order.
+   //
+   // param fd:          the local destination
+   // param start:       offset to start the copy from
+   // param size:        size of the file
+   // param nslots:      number of chunks in flight
+   // param chunkSize:   size of a single chunk
+   // param progressbar: show the progress of the copy
+   // param checksum:    running adler32 of the destination (in/out)
+   // returns:           0 in case of success, -1 otherwise
+
+   using namespace XrdCl;
+
+   XrdSysCondVar cond(0);
+   std::vector<TNetXNGReadSlot> slots(nslots);
+   for (Int_t i = 0; i < nslots; ++i) {
+      slots[i].fCond = &cond;
+      slots[i].fBuffer.resize(chunkSize);
+   }
+
+   // Copies are bulk traffic for the rate limiter, behind the other reads
+   std::string host;
+   if (TNetXNGRateLimiter::IsEnabled())
+      host = GetXrdFile()->GetDataServer();
+
+   TStopwatch watch;
+   Long64_t   next  = start;   // Offset of the next chunk to request
+   Int_t      rc    = 0;
+   Int_t      nchunks = (Int_t) ((size - start + chunkSize - 1) / chunkSize);
+
+   for (Int_t i = 0; i < nchunks + nslots; ++i) {
+      TNetXNGReadSlot &slot = slots[i % nslots];
+
+      // Write the chunk which is due, then reuse its slot for the next one
+      if (slot.fInFlight) {
+         cond.Lock();
+         while (!slot.fDone) cond.Wait();
+         cond.UnLock();
+         slot.fInFlight = kFALSE;
+
+         if (!rc && !slot.fStatus.IsOK()) {
+            Error("Cp", "%s", slot.fStatus.GetErrorMessage().c_str());
+            rc = -1;
+         } else if (!rc && slot.fBytesRead != slot.fLength) {
+            Error("Cp", "short read at offset %lld: %u instead of %u bytes",
+                  slot.fOffset, slot.fBytesRead, slot.fLength);
+            rc = -1;
+         }
+
+         if (!rc) {
+            for (UInt_t done = 0; done < slot.fLength; ) {
+               ssize_t n = pwrite(fd, &slot.fBuffer[done],
+                                  slot.fLength - done, slot.fOffset + done);
+               if (n < 0) {
+                  if (errno == EINTR) continue;
+                  SysError("Cp", "write failed");
+                  rc = -1;
+                  break;
+               }
+               done += n;
+            }
+            checksum = adler32(checksum, (const Bytef *) &slot.fBuffer[0],
+                               slot.fLength);
+
+            BumpReadCounters(slot.fLength);
+
+            if (progressbar)
+               CopyProgress(slot.fOffset + slot.fLength, size, watch);
+         }
+      }
+
+      // Once failed, only drain what is still in flight
+      if (rc || next >= size)
+         continue;
+
+      slot.fOffset = next;
+      slot.fLength = (UInt_t) TMath::Min(chunkSize, size - next);
+      slot.fDone   = kFALSE;
+      next += slot.fLength;
+
+      if (!host.empty()) {
+         TNetXNGRateLimiter::Acquire(host.c_str(), slot.fLength,
+                                     TNetXNGRateLimiter::kBulk);
+         slot.fHost = host.c_str();
+      }
+
+      XRootDStatus st = GetXrdFile()->Read(slot.fOffset, slot.fLength,
+                                           &slot.fBuffer[0], &slot);
+      if (!st.IsOK()) {
+         Error("Cp", "%s", st.GetErrorMessage().c_str());
+         if (slot.fHost)
+            TNetXNGRateLimiter::Release(slot.fHost, slot.fLength,
+                                        TNetXNGRateLimiter::kBulk);
+         slot.fHost = 0;
+         rc = -1;
+         continue;
+      }
+      slot.fInFlight = kTRUE;
+   }
+
+   if (progressbar) {
+      CopyProgress(rc ? next : size, size, watch);
+      fprintf(stderr, "\n");
+   }
+
+   return rc;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::GetServerChecksum(TString &type, TString &value,
+                                      const char *server)
+{
+   // Ask the data server for the checksum of the file
+   //
+   // param type:   the checksum algorithm, e.g. "adler32" (out)
+   // param value:  the checksum value as a hex string (out)
+   // param server: the data server, 0 for the one the file is open at
+   // returns:      kFALSE if the server did not provide a checksum
+
+   using namespace XrdCl;
+
+   if (!server && fInMemory) {
+      Error("GetServerChecksum", "%s is held in memory and closed on the "
+            "server, give the data server explicitly", GetName());
+      return kFALSE;
+   }
+
+   URL url(server ? std::string(server) : GetXrdFile()->GetDataServer());
+   FileSystem fs(url);
+   Buffer arg;
+   Buffer *response = 0;
+   arg.FromString(fUrl->GetPath());
+
+   XRootDStatus status = fs.Query(QueryCode::Checksum, arg, response);
+   if (!status.IsOK()) {
+      if (gDebug > 0)
+         Info("GetServerChecksum", "%s", status.GetErrorMessage().c_str());
+      delete response;
+      return kFALSE;
+   }
+
+   Bool_t ok = TNetXNGSystem::ParseChecksum(response->ToString().c_str(),
+                                            type, value);
+   delete response;
+   return ok;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::GetWriteChecksum(const char *type, TString &value) const
+{
+   // Get the checksum of the data written to the file, computed as it was
+   // written; complete once the file is closed. Writes are accounted for at
+   // their offset, so seeks and the patches of TFile are handled, except
+   // for the rewrite of part of a large block (see TNetXNGChecksum). It is
+   // not available either once a write failed.
+   //
+   // param type:  "adler32" or "crc32c"
+   // param value: the checksum as a hex string, as XRootD formats it (out)
+   // returns:     kFALSE if the checksum is not available
+
+   return fChecksum && fChecksum->Get(type, value);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::VerifyChecksum(const char *server)
+{
+   // Compare the checksum computed while writing with the one of the data
+   // server, once the file is closed
+   //
+   // param server: the data server the file was written to
+
+   TString type, value, written;
+   if (!GetServerChecksum(type, value, server)) {
+      Warning("Close", "no checksum from %s, %s not verified", server,
+              GetName());
+      return;
+   }
+   if (!GetWriteChecksum(type, written)) {
+      Warning("Close", "%s checksum of %s not available, not verified",
+              type.Data(), GetName());
+      return;
+   }
+
+   if (strtoul(value.Data(), 0, 16) != strtoul(written.Data(), 0, 16))
+      Error("Close", "%s checksum mismatch for %s: %s written, %s on %s",
+            type.Data(), GetName(), written.Data(), value.Data(), server);
+   else if (gDebug > 0)
+      Info("Close", "%s checksum of %s verified: %s", type.Data(),
+           GetName(), value.Data());
+}
+
+//______________________________________________________________________________
+TNetXNGFileMap *TNetXNGFile::Map(Long64_t maxResident, Int_t readAhead)
+{
+   // Map the file read-only into memory. Nothing is read up front: pages are
+   // fetched from the server when first touched, in batches of vector reads
+   // including some read-ahead, which move to another replica along with
+   // the file. Pages which cannot be read at all are made inaccessible, so
+   // that touching them raises SIGSEGV instead of returning wrong data. The
+   // caller owns the returned object, which must be deleted before this
+   // file.
+   //
+   // param maxResident: cap on the memory filled with remote data in bytes,
+   //                    the oldest pages being dropped (and re-fetched if
+   //                    touched again) beyond it; 0 means no cap
+   // param readAhead:   number of pages fetched after each faulting page,
+   //                    0 for the default
+   // returns:           the mapping, or 0 in case of failure or if lazy
+   //                    mapping is not supported on this platform
+
+   // Check the file isn't a zombie or closed
+   if (!IsUseable())
+      return 0;
+
+   // The data are in memory already, and the remote file is closed
+   if (fInMemory) {
+      Error("Map", "%s is held in memory, read it with ReadBuffer instead",
+            GetName());
+      return 0;
+   }
+
+   Long64_t size = GetSize();
+   if (size < 0) {
+      Error("Map", "cannot get the size of the file");
+      return 0;
+   }
+
+   TNetXNGFileMap *map = new TNetXNGFileMap(this, size, maxResident,
+                                            readAhead);
+   if (!map->IsValid()) {
+      delete map;
+      return 0;
+   }
+
+   return map;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGFile::GetWindow() const
+{
+   // Get the number of bytes a large read keeps in flight (0 = no limit)
+
+   XrdSysMutexHelper lock(fMutex);
+   return fWindow;
+}
+
+//______________________________________________________________________________
+Double_t TNetXNGFile::GetBandwidth() const
+{
+   // Get the smoothed rate of the large reads in bytes per second, as
+   // measured by the auto-tuning (0 if not known)
+
+   XrdSysMutexHelper lock(fMutex);
+   return fBandwidth;
+}
+
+//______________________________________________________________________________
+Double_t TNetXNGFile::GetLatency() const
+{
+   // Get the lowest latency of a small read in seconds, an estimate of the
+   // round trip time to the server measured by the auto-tuning (0 if not
+   // known)
+
+   XrdSysMutexHelper lock(fMutex);
+   return fMinLatency;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::ConfigureTransport(Int_t netopt)
+{
+   // Choose the transport settings of the file. XrdCl does not let the
+   // socket buffers be sized, the kernel tunes them up to a few MB per
+   // socket: a larger window is obtained with several substreams, over
+   // which large reads are split. The settings are, by precedence:
+   //
+   //   - the window: netopt if > 0, otherwise NetXNG.Window (default 0,
+   //     no limit);
+   //   - the substreams: the value found by the auto-tuning for the host
+   //     of the URL, NetXNG.SubStreams.<host>, NetXNG.SubStreams (default
+   //     0, the XrdCl default), or enough substreams to carry the window;
+   //   - NetXNG.AutoTune (default 0) enables the measurement of the read
+   //     latency and rate, from which the window of the file and the
+   //     substreams of the next opens to its data server are adjusted.
+   //
+   // The substreams are a limited knob. XrdCl takes their number from its
+   // process-wide environment, and only when it creates the channel to a
+   // server: an open to a server which has a channel already, e.g. opened
+   // by another file, gets the substreams of that channel whatever is asked
+   // here. The auto-tuned value thus only applies to the opens naming the
+   // data server directly once XrdCl closed its idle channel
+   // (DataServerTTL). While an open sets the value, the channels created
+   // meanwhile by other opens (TNetXNGSystem, TNetXNGInputPipeline, a
+   // recovery) get it as well; an open asking for another value at the
+   // same time gets the one in place.
+   //
+   // param netopt: TCP window size in bytes, 0 for the default
+
+   fAutoTune = gEnv->GetValue("NetXNG.AutoTune", 0) != 0;
+   fWindow   = netopt > 0 ? netopt : gEnv->GetValue("NetXNG.Window", 0);
+
+   std::string host = fUrl->GetHostName();
+   fSubStreams = gEnv->GetValue(Form("NetXNG.SubStreams.%s", host.c_str()),
+                                gEnv->GetValue("NetXNG.SubStreams", 0));
+   if (fSubStreams <= 0 && fWindow > kSocketWindow)
+      fSubStreams = (fWindow + kSocketWindow - 1) / kSocketWindow;
+
+   if (fAutoTune) {
+      XrdSysMutexHelper lock(gTransportMutex);
+      std::map<std::string, Int_t>::iterator it =
+         gTunedSubStreams.find(fUrl->GetHostId());
+      if (it != gTunedSubStreams.end())
+         fSubStreams = it->second;
+   }
+
+   fSubStreams = TMath::Min(fSubStreams, kMaxSubStreams);
+   if (gDebug > 0)
+      Info("ConfigureTransport", "substreams: %d window: %d auto-tune: %d",
+           fSubStreams, fWindow, fAutoTune);
+}
+
+//______________________________________________________________________________
+XrdCl::XRootDStatus TNetXNGFile::OpenFile(XrdCl::ResponseHandler *handler)
+{
+   // Open the file with the current URL and mode, asking for the substreams
+   // of the file. The open to the data server is covered only when it is
+   // synchronous; redirections followed by an asynchronous open use the
+   // XrdCl default.
+   //
+   // param handler: handler of an asynchronous open, 0 to open synchronously
+   // returns:       the status of the open (of the request for an
+   //                asynchronous one)
+   //
+   // If the host of the URL is one of the equivalent entry points listed
+   // in NetXNG.Redirectors, a synchronous open for reading is sent to the
+   // fastest ones at the same time and the first to succeed wins (see
+   // TNetXNGRace); the URL then points to it. Opens for writing, which
+   // would create or truncate the file through each of them, and
+   // asynchronous opens go to the fastest one only.
+
+   using namespace XrdCl;
+
+   TNetXNGSubStreamsGuard guard(fSubStreams);
+   fOpenStart = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+
+   std::vector<std::string> hosts;
+   if (TNetXNGRace::GetEntryPoints(*fUrl, hosts) &&
+       (handler || hosts.size() == 1 || fMode != OpenFlags::Read))
+      SetEntryPoint(*fUrl, hosts[0]);
+   else if (hosts.size() > 1)
+      return RaceOpen(hosts);
+
+   if (handler)
+      return fFile->Open(fUrl->GetURL(), fMode, Access::None, handler);
+
+   XRootDStatus st = fFile->Open(fUrl->GetURL(), fMode);
+   if (fOpenStart)
+      Trace(TNetXNGTrace::kOpen, fOpenStart, -1, 0, 1, st.IsOK());
+   return st;
+}
+
+//______________________________________________________________________________
+XrdCl::XRootDStatus TNetXNGFile::RaceOpen(const std::vector<std::string> &hosts)
+{
+   // Open the file through several equivalent entry points at the same
+   // time, keeping the first one to succeed, for OpenFile()
+   //
+   // param hosts: the entry points, as host:port
+   // returns:     the status of the open which won, or one of the errors
+
+   using namespace XrdCl;
+
+   TNetXNGOpenRace *race = new TNetXNGOpenRace(hosts, *fUrl, fMode);
+   Int_t      winner   = -1;
+   AnyObject *response = 0;
+   XRootDStatus st = race->Run(winner, response);
+   delete response;
+   if (fOpenStart)
+      Trace(TNetXNGTrace::kOpen, fOpenStart, -1, 0, 1, st.IsOK());
+
+   if (winner >= 0) {
+      if (gDebug > 0)
+         Info("RaceOpen", "opened through %s", hosts[winner].c_str());
+      XrdSysMutexHelper lock(fMutex);
+      delete fFile;
+      fFile = race->TakeFile(winner);
+      SetEntryPoint(*fUrl, hosts[winner]);
+   }
+   race->Release();
+   return st;
+}
+
+//______________________________________________________________________________
+XrdCl::XRootDStatus TNetXNGFile::ReadSplit(XrdCl::File *file, char *buffer,
+                                           Long64_t position, Int_t length,
+                                           uint32_t &bytesRead)
+{
+   // Read a large chunk as several requests in flight at the same time, so
+   // that XrdCl can spread them over the substreams of the channel. At most
+   // fWindow bytes are requested at a time.
+   //
+   // param file:      the XRootD file to read from
+   // param buffer:    a pointer to a buffer big enough to hold the data
+   // param position:  offset from the beginning of the file
+   // param length:    number of bytes to be read
+   // param bytesRead: number of bytes actually read, less than length at
+   //                  the end of the file (out)
+   // returns:         the status of the first failed request, if any
+
+   using namespace XrdCl;
+
+   Int_t window = GetWindow();
+   Int_t nparts = TMath::Max(fSubStreams, (window + kSocketWindow - 1) /
+                                          kSocketWindow);
+   nparts = TMath::Min(TMath::Min(nparts, kMaxSubStreams),
+                       length / kMinSplitSize);
+   Int_t partSize = (length + nparts - 1) / nparts;
+   Int_t maxInFlight = window > 0 ? TMath::Max(1, window / partSize) : nparts;
+
+   XrdSysCondVar cond(0);
+   std::vector<TNetXNGReadSlot> slots(nparts);
+   XRootDStatus  status;
+   Int_t         next = 0, inFlight = 0;
+
+   cond.Lock();
+   while (true) {
+
+      // Collect the completed reads
+      for (Int_t i = 0; i < next; ++i) {
+         TNetXNGReadSlot &slot = slots[i];
+         if (!slot.fInFlight || !slot.fDone)
+            continue;
+         slot.fInFlight = kFALSE;
+         --inFlight;
+         if (status.IsOK() && !slot.fStatus.IsOK())
+            status = slot.fStatus;
+      }
+
+      // Once failed, only drain what is still in flight
+      if (!inFlight && (next == nparts || !status.IsOK()))
+         break;
+
+      if (next < nparts && inFlight < maxInFlight && status.IsOK()) {
+         TNetXNGReadSlot &slot = slots[next++];
+         slot.fCond     = &cond;
+         slot.fOffset   = position + (Long64_t) (next - 1) * partSize;
+         slot.fLength   = TMath::Min(partSize, length - (next - 1) * partSize);
+         slot.fInFlight = kTRUE;
+         ++inFlight;
+         cond.UnLock();
+
+         XRootDStatus st = file->Read(slot.fOffset, slot.fLength,
+                                      buffer + (slot.fOffset - position),
+                                      &slot);
+         cond.Lock();
+         if (!st.IsOK()) {
+            slot.fInFlight = kFALSE;
+            --inFlight;
+            status = st;
+         }
+         continue;
+      }
+
+      cond.Wait();
+   }
+   cond.UnLock();
+
+   // The data is contiguous up to the first short read
+   bytesRead = 0;
+   for (Int_t i = 0; i < nparts; ++i) {
+      bytesRead += slots[i].fBytesRead;
+      if (slots[i].fBytesRead < slots[i].fLength)
+         break;
+   }
+   return status;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::TuneTransport(Long64_t bytes, Double_t elapsed)
+{
+   // Feed the auto-tuning with a completed read. Small reads give the round
+   // trip time, large ones the rate once the round trip is taken out. The
+   // window is set to twice the bandwidth-delay product: as long as the
+   // window is what limits the rate, it keeps growing from one large read
+   // to the next, and it settles when the link is full. The substreams it
+   // takes are remembered for the next opens to the data server (see
+   // ConfigureTransport).
+   //
+   // param bytes:   number of bytes read
+   // param elapsed: duration of the read in seconds
+
+   if (elapsed <= 0)
+      return;
+
+   Int_t nstreams;
+   {
+      XrdSysMutexHelper lock(fMutex);
+      if (bytes <= kSmallRead) {
+         if (fMinLatency <= 0 || elapsed < fMinLatency)
+            fMinLatency = elapsed;
+         return;
+      }
+      if (bytes < kMinSplitSize || fMinLatency <= 0 ||
+          elapsed <= fMinLatency)
+         return;
+
+      Double_t rate = bytes / (elapsed - fMinLatency);
+      fBandwidth = fBandwidth > 0 ? 0.75 * fBandwidth + 0.25 * rate : rate;
+
+      Double_t window = 2 * fBandwidth * fMinLatency;
+      fWindow  = (Int_t) TMath::Max((Double_t) kMinWindow,
+                                    TMath::Min((Double_t) kMaxWindow, window));
+      nstreams = TMath::Min(kMaxSubStreams,
+                            (fWindow + kSocketWindow - 1) / kSocketWindow);
+   }
+
+   std::string server = GetXrdFile()->GetDataServer();
+   XrdSysMutexHelper lock(gTransportMutex);
+   gTunedSubStreams[server] = nstreams;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGFile::GetNRecoveries() const
+{
+   // Get the number of times the file was re-opened on another replica
+   // after a failure of its data server
+
+   XrdSysMutexHelper lock(fMutex);
+   return fNRecoveries;
+}
+
+//______________________________________________________________________________
+XrdCl::File *TNetXNGFile::GetXrdFile() const
+{
+   // Get the XRootD file reads are sent to, which a recovery may replace
+
+   XrdSysMutexHelper lock(fMutex);
+   return fFile;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::Trace(Int_t op, Long64_t start, Long64_t offset,
+                        Long64_t size, Int_t nchunks, Bool_t ok,
+                        XrdCl::File *file) const
+{
+   // Record a request of the file with TNetXNGTrace
+   //
+   // param op:      the kind of request (TNetXNGTrace::EOperation)
+   // param start:   when it was issued, as given by TNetXNGTrace::Now()
+   // param offset:  offset in the file, -1 if not applicable
+   // param size:    number of bytes requested
+   // param nchunks: number of chunks of a vector read, 1 otherwise
+   // param ok:      whether it succeeded
+   // param file:    the XRootD file it went to, 0 for the current one
+
+   if (!file)
+      file = GetXrdFile();
+   TNetXNGTrace::EOperation operation = (TNetXNGTrace::EOperation) op;
+
+   // The names are interned once per XRootD file, not per request
+   {
+      XrdSysMutexHelper lock(fMutex);
+      if (fTraceFile == file && fTraceName >= 0) {
+         TNetXNGTrace::Record(operation, start, fTraceName, fTraceServer,
+                              offset, size, nchunks, ok);
+         return;
+      }
+   }
+
+   std::string server = file->GetDataServer();
+   Int_t nameId   = TNetXNGTrace::Intern(GetName());
+   Int_t serverId = TNetXNGTrace::Intern(server.c_str());
+   TNetXNGTrace::Record(operation, start, nameId, serverId, offset, size,
+                        nchunks, ok);
+
+   // Keep them for the next requests, giving back the previous ones
+   XrdSysMutexHelper lock(fMutex);
+   std::swap(nameId, fTraceName);
+   std::swap(serverId, fTraceServer);
+   fTraceFile = file;
+   TNetXNGTrace::ReleaseName(nameId);
+   TNetXNGTrace::ReleaseName(serverId);
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::IsRecoverable(const XrdCl::XRootDStatus &status)
+{
+   // Check if a failed request may succeed on another replica: the data
+   // server went away, did not answer in time or could not access its disk
+   //
+   // param status: the status of the failed request
+
+   using namespace XrdCl;
+
+   switch (status.code) {
+      case errSocketError:
+      case errSocketTimeout:
+      case errSocketDisconnected:
+      case errStreamDisconnect:
+      case errConnectionError:
+      case errInvalidSession:
+      case errOperationExpired:
+         return kTRUE;
+      case errErrorResponse:
+         return status.errNo == kXR_IOError || status.errNo == kXR_FSError ||
+                status.errNo == kXR_ServerError;
+      default:
+         return kFALSE;
+   }
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::Recover(XrdCl::File *failed,
+                            const XrdCl::XRootDStatus &status,
+                            Double_t &deadline)
+{
+   // Re-open a file opened for reading on another replica after its data
+   // server failed, so that the failed request can be sent again. The
+   // redirector is asked to locate the file anew, avoiding the data servers
+   // which already failed ("tried" CGI). Attempts are made until
+   // NetXNG.RecoveryTime seconds (default 60, 0 to disable the recovery)
+   // have passed since the first failure of the request. A replica whose
+   // size differs from the one of the original file is not used.
+   //
+   // Reads running concurrently with the recovery fail on the old file and
+   // find it replaced. The old file is closed in the background, and not
+   // deleted before this object (see TNetXNGRetiredFile).
+   //
+   // param failed:   the XRootD file the request failed on
+   // param status:   the status of the failed request
+   // param deadline: end of the time budget, 0 on the first failure of the
+   //                 request (in/out)
+   // returns:        kTRUE if the request should be sent again
+
+   using namespace XrdCl;
+
+   if (fMode != OpenFlags::Read)
+      return kFALSE;
+
+   // The file was replaced meanwhile, and maybe closed already: whatever
+   // the error, the request goes to the new one
+   if (GetXrdFile() != failed)
+      return kTRUE;
+
+   if (!IsRecoverable(status))
+      return kFALSE;
+
+   if (deadline <= 0) {
+      Double_t budget = gEnv->GetValue("NetXNG.RecoveryTime", 60.);
+      if (budget <= 0)
+         return kFALSE;
+      deadline = TTimeStamp().AsDouble() + budget;
+   }
+
+   XrdSysMutexHelper recoveryLock(fRecoveryMutex);
+
+   // Another thread already did it
+   if (GetXrdFile() != failed)
+      return kTRUE;
+
+   std::string server = GetHostName(failed->GetDataServer());
+   if (!server.empty())
+      fTried.push_back(server);
+
+   Warning("Recover", "%s: %s, looking for another replica",
+           server.c_str(), status.ToStr().c_str());
+
+   Int_t delay = 1;
+   while (kTRUE) {
+      Double_t left = deadline - TTimeStamp().AsDouble();
+      if (left <= 0)
+         break;
+
+      URL url(fUrl->GetURL());
+      URL::ParamsMap params = url.GetParams();
+      std::string tried;
+      for (UInt_t i = 0; i < fTried.size(); ++i)
+         tried += (i ? "," : "") + fTried[i];
+      if (!tried.empty())
+         params["tried"] = tried;
+      url.SetParams(params);
+
+      File *file = new File();
+      Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+      XRootDStatus st = file->Open(url.GetURL(), fMode, Access::None,
+                                   (uint16_t) TMath::Min(left + 1, 65535.));
+      if (t0)
+         Trace(TNetXNGTrace::kOpen, t0, -1, 0, 1, st.IsOK(), file);
+      if (st.IsOK()) {
+
+         // Make sure this is the same file
+         StatInfo *info = 0;
+         st = file->Stat(false, info);
+         if (st.IsOK() && info && fStatInfo &&
+             info->GetSize() != fStatInfo->GetSize()) {
+            Warning("Recover", "%s: size mismatch, replica skipped",
+                    file->GetDataServer().c_str());
+            st = XRootDStatus(stError, errDataError);
+         }
+         delete info;
+
+         if (st.IsOK()) {
+            TNetXNGRetiredFile *retired;
+            {
+               XrdSysMutexHelper lock(fMutex);
+               retired = new TNetXNGRetiredFile(fFile);
+               fRetired.push_back(retired);
+               fFile = file;
+               ++fNRecoveries;
+            }
+            retired->Close();
+            Info("Recover", "re-opened on %s", file->GetDataServer().c_str());
+            return kTRUE;
+         }
+
+         fTried.push_back(GetHostName(file->GetDataServer()));
+         file->Close();
+      } else if (gDebug > 0) {
+         Info("Recover", "%s", st.ToStr().c_str());
+      }
+      delete file;
+
+      left = deadline - TTimeStamp().AsDouble();
+      if (left <= 0)
+         break;
+      gSystem->Sleep((UInt_t) (TMath::Min((Double_t) delay, left) * 1000));
+      delay = TMath::Min(delay * 2, 16);
+   }
+
+   Error("Recover", "no replica could be opened in time");
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::GetVectorReadLimits(Int_t &maxChunk, Int_t &maxChunks)
+{
+   // Get the max size of a single readv chunk and the max number of chunks
+   // per readv supported by the data server. The values are queried once
+   // and cached.
+   //
+   // param maxChunk:  max size of a readv chunk (out)
+   // param maxChunks: max number of chunks in a readv (out)
+   // returns:         kFALSE if the server could not be queried
+
+   using namespace XrdCl;
+
+   {
+      XrdSysMutexHelper lock(fMutex);
+      if (fReadvIorMax) {
+         maxChunk  = fReadvIorMax;
+         maxChunks = fReadvIovMax;
+         return kTRUE;
+      }
+   }
+
+   // Several threads may get here at first: they all query the server, which
+   // is harmless, rather than waiting for each other with a lock held
+   Int_t iorMax = 0, iovMax = 0;
+   URL url(GetXrdFile()->GetDataServer());
+   FileSystem fs(url);
+   Buffer arg;
+   Buffer *response = 0;
+   arg.FromString(std::string("readv_ior_max readv_iov_max"));
+
+   XRootDStatus status = fs.Query(QueryCode::Config, arg, response);
+   if (!status.IsOK()) {
+      Error("GetVectorReadLimits", "%s", status.GetErrorMessage().c_str());
+      delete response;
+      return kFALSE;
+   }
+
+   // One value per line, in the order of the query
+   TString values(response->ToString());
+   TString token;
+   Ssiz_t from = 0;
+   if (values.Tokenize(token, from, "\n"))
+      iorMax = token.Atoi();
+   if (values.Tokenize(token, from, "\n"))
+      iovMax = token.Atoi();
+   delete response;
+
+   if (iorMax <= 0) {
+      Error("GetVectorReadLimits", "invalid readv_ior_max: %s",
+            values.Data());
+      return kFALSE;
+   }
+   if (iovMax <= 0)
+      iovMax = 1024;
+
+   XrdSysMutexHelper lock(fMutex);
+   fReadvIorMax = maxChunk  = iorMax;
+   fReadvIovMax = maxChunks = iovMax;
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::ReadWholeFile()
+{
+   // Read a whole file opened for reading into memory, then close the
+   // remote file in the background: all the later reads are served from
+   // memory. This is done when the URL option wholefile=1 is given (for
+   // files up to 1 GB), or for files not bigger than NetXNG.WholeFileSize
+   // bytes (default 0, never) unless wholefile=0 is given. The size comes
+   // with the open, so the file costs the open and a single read; XrdCl
+   // cannot send the read before the open returned the file handle.
+   //
+   // returns: kTRUE if the file is in memory
+
+   using namespace XrdCl;
+
+   if (!fWholeFile)
+      return kFALSE;
+
+   Long64_t size = GetSize();
+   if (size <= 0 || size > kMaxWholeFile)
+      return kFALSE;
+   if (fWholeFile < 0 && size > gEnv->GetValue("NetXNG.WholeFileSize", 0))
+      return kFALSE;
+
+   std::vector<char> &data = fPrefetched[0];
+   data.resize(size);
+   uint32_t bytesRead = 0;
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XRootDStatus st = fFile->Read(0, size, &data[0], bytesRead);
+   if (t0)
+      Trace(TNetXNGTrace::kRead, t0, 0, size, 1, st.IsOK());
+   if (!st.IsOK() || bytesRead != size) {
+      if (gDebug > 0)
+         Info("ReadWholeFile", "%s bytes read: %d", st.ToStr().c_str(),
+              bytesRead);
+      fPrefetched.clear();
+      return kFALSE;
+   }
+   BumpReadCounters(bytesRead);
+
+   // Nothing else is needed from the server
+   File *remote = fFile;
+   TNetXNGCloseHandler *handler = new TNetXNGCloseHandler(remote);
+   st = remote->Close(handler);
+   if (!st.IsOK()) {
+      delete handler;
+      delete remote;
+   }
+   {
+      XrdSysMutexHelper lock(fMutex);
+      fFile = new File();
+   }
+   fInMemory = kTRUE;
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::StartProfile()
+{
+   // Record the reads of the file, and replay those of the last job which
+   // read the same file as asynchronous vector reads running ahead of the
+   // consumer. Profiles are kept in NetXNG.ProfileDir, one per path, size
+   // and modification time, so that a modified file gets a new one. At most
+   // NetXNG.ProfileWindow bytes (default 64 MB) are prefetched and not yet
+   // read at any time.
+
+   const char *dir = gEnv->GetValue("NetXNG.ProfileDir", "");
+   if (!*dir || !fStatInfo)
+      return;
+   if (gSystem->AccessPathName(dir) && gSystem->mkdir(dir, kTRUE)) {
+      Warning("StartProfile", "cannot create %s", dir);
+      return;
+   }
+
+   std::string key = Form("%s %llu %llu", fUrl->GetPath().c_str(),
+                          (ULong64_t) fStatInfo->GetSize(),
+                          (ULong64_t) fStatInfo->GetModTime());
+   fProfile = new TNetXNGAccessProfile(this,
+      TNetXNGAccessProfile::GetProfilePath(dir, key));
+
+   // The limits are queried now, as the replay sends from XrdCl threads
+   Int_t maxRead, maxChunks;
+   if (fProfile->Load(GetSize()) && GetVectorReadLimits(maxRead, maxChunks))
+      fProfile->Start(gEnv->GetValue("NetXNG.ProfileWindow", 67108864),
+                      maxRead, maxChunks);
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::AdoptInput()
+{
+   // Take over the file opened for this URL by a TNetXNGInputPipeline, with
+   // the data it fetched: either the whole file, which is then served from
+   // memory, or the blocks TFile::Init reads.
+   //
+   // returns: kFALSE if no pipeline holds the file
+
+   using namespace XrdCl;
+
+   File     *file = 0;
+   StatInfo *info = 0;
+   std::map<Long64_t, std::vector<char> > blocks;
+   if (!TNetXNGInputPipeline::Take(fUrl->GetURL(), file, info, blocks))
+      return kFALSE;
+
+   Long64_t bytes = 0;
+   std::map<Long64_t, std::vector<char> >::iterator it;
+   for (it = blocks.begin(); it != blocks.end(); ++it)
+      bytes += it->second.size();
+   BumpReadCounters(bytes);
+
+   fPrefetched.swap(blocks);
+   SetStatInfo(info);
+   if (file) {
+      delete fFile;
+      fFile = file;
+   } else {
+      fInMemory = kTRUE;
+   }
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::PrefetchInit()
+{
+   // Read the blocks TFile::Init needs ahead of it: the beginning of the
+   // file (header and top directory) together with its end (usually keys
+   // list, streamer info and free segments) in a single vector read. If the
+   // header then points to a keys list or streamer info outside of these
+   // blocks, they are fetched with a second vector read. The sizes of the
+   // blocks are set by NetXNG.PrefetchHead (default 64 kB) and
+   // NetXNG.PrefetchTail (default 512 kB); 0 for both disables this.
+
+   Long64_t head = gEnv->GetValue("NetXNG.PrefetchHead", 65536);
+   Long64_t tail = gEnv->GetValue("NetXNG.PrefetchTail", 524288);
+   if (head <= 0 && tail <= 0)
+      return;
+
+   Long64_t size = GetSize();
+   if (size <= 0)
+      return;
+
+   std::vector<std::pair<Long64_t, Long64_t> > ranges;
+   if (head + tail >= size) {
+      ranges.push_back(std::make_pair(0LL, size));
+   } else {
+      if (head > 0) ranges.push_back(std::make_pair(0LL, head));
+      if (tail > 0) ranges.push_back(std::make_pair(size - tail, tail));
+   }
+   if (!Prefetch(ranges))
+      return;
+
+   // Decode the header, as TFile::Init does
+   std::map<Long64_t, std::vector<char> >::iterator it = fPrefetched.begin();
+   std::vector<char> &block = it->second;
+   if (it->first != 0 || block.size() < 64 || strncmp(&block[0], "root", 4))
+      return;
+
+   char *buffer = &block[4];
+   Int_t    version, begin, nbytesInfo, nbytesName, nbytesFree, nfree, i32;
+   Long64_t seekInfo;
+   Char_t   units;
+   frombuf(buffer, &version);
+   frombuf(buffer, &begin);
+   if (version < 1000000) {
+      frombuf(buffer, &i32);        // fEND
+      frombuf(buffer, &i32);        // fSeekFree
+      frombuf(buffer, &nbytesFree);
+      frombuf(buffer, &nfree);
+      frombuf(buffer, &nbytesName);
+      frombuf(buffer, &units);
+      frombuf(buffer, &i32);        // fCompress
+      frombuf(buffer, &i32);
+      seekInfo = i32;
+   } else {
+      Long64_t i64;
+      frombuf(buffer, &i64);        // fEND
+      frombuf(buffer, &i64);        // fSeekFree
+      frombuf(buffer, &nbytesFree);
+      frombuf(buffer, &nfree);
+      frombuf(buffer, &nbytesName);
+      frombuf(buffer, &units);
+      frombuf(buffer, &i32);        // fCompress
+      frombuf(buffer, &seekInfo);
+   }
+   frombuf(buffer, &nbytesInfo);
+
+   ranges.clear();
+   if (seekInfo > 0 && nbytesInfo > 0 &&
+       !ReadPrefetched(0, seekInfo, nbytesInfo))
+      ranges.push_back(std::make_pair(seekInfo, (Long64_t) nbytesInfo));
+
+   // The top directory record, right after its key, gives the keys list
+   Long64_t dirRecord = (Long64_t) begin + nbytesName;
+   if (dirRecord + 42 <= (Long64_t) block.size()) {
+      buffer = &block[dirRecord];
+      Short_t  dirVersion;
+      UInt_t   datime;
+      Int_t    nbytesKeys;
+      Long64_t seekKeys;
+      frombuf(buffer, &dirVersion);
+      frombuf(buffer, &datime);     // fDatimeC
+      frombuf(buffer, &datime);     // fDatimeM
+      frombuf(buffer, &nbytesKeys);
+      frombuf(buffer, &i32);        // fNbytesName
+      if (dirVersion > 1000) {
+         frombuf(buffer, &seekKeys); // fSeekDir
+         frombuf(buffer, &seekKeys); // fSeekParent
+         frombuf(buffer, &seekKeys);
+      } else {
+         frombuf(buffer, &i32);
+         frombuf(buffer, &i32);
+         frombuf(buffer, &i32);
+         seekKeys = i32;
+      }
+
+      if (seekKeys > 0 && nbytesKeys > 0 &&
+          !ReadPrefetched(0, seekKeys, nbytesKeys))
+         ranges.push_back(std::make_pair(seekKeys, (Long64_t) nbytesKeys));
+   }
+
+   // Anything outside of the file is garbage: let TFile::Init deal with it
+   for (UInt_t i = 0; i < ranges.size(); ++i) {
+      if (ranges[i].first + ranges[i].second > size)
+         return;
+   }
+
+   if (!ranges.empty())
+      Prefetch(ranges);
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::Prefetch(std::vector<std::pair<Long64_t, Long64_t> > &ranges)
+{
+   // Read a set of ranges with a single vector read, when the server limits
+   // allow it, and keep them for ReadPrefetched. Unless already known, the
+   // limits are not queried, which would cost a round trip: the protocol
+   // defaults are assumed.
+   //
+   // param ranges: (offset, length) of the ranges to read
+   // returns:      kTRUE in case of success
+
+   using namespace XrdCl;
+
+   Int_t maxChunk  = kDefaultReadvIorMax;
+   Int_t maxChunks = kDefaultReadvIovMax;
+   {
+      XrdSysMutexHelper lock(fMutex);
+      if (fReadvIorMax) {
+         maxChunk  = fReadvIorMax;
+         maxChunks = fReadvIovMax;
+      }
+   }
+
+   ChunkList chunks;
+   Long64_t  total = 0;
+   for (UInt_t i = 0; i < ranges.size(); ++i) {
+      for (Long64_t off = 0; off < ranges[i].second; off += maxChunk) {
+         chunks.push_back(ChunkInfo(ranges[i].first + off,
+                          TMath::Min((Long64_t) maxChunk,
+                                     ranges[i].second - off)));
+      }
+      total += ranges[i].second;
+   }
+
+   // Init waits for it: this is demand as far as the rate limiter goes
+   TNetXNGRateGuard guard(fFile, total);
+   std::vector<char> data(total);
+   char *cursor = &data[0];
+   for (UInt_t first = 0; first < chunks.size(); first += maxChunks) {
+      UInt_t last = TMath::Min((UInt_t) chunks.size(), first + maxChunks);
+      ChunkList batch(chunks.begin() + first, chunks.begin() + last);
+
+      VectorReadInfo *info = 0;
+      Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+      XRootDStatus st = fFile->VectorRead(batch, (void *) cursor, info);
+      if (t0) {
+         Long64_t bytes = 0;
+         for (UInt_t i = 0; i < batch.size(); ++i)
+            bytes += batch[i].length;
+         Trace(TNetXNGTrace::kVectorRead, t0, batch[0].offset, bytes,
+               batch.size(), st.IsOK());
+      }
+      if (!st.IsOK()) {
+         if (gDebug > 0)
+            Info("Prefetch", "%s", st.GetErrorMessage().c_str());
+         delete info;
+         return kFALSE;
+      }
+
+      BumpReadCounters(info->GetSize());
+      delete info;
+
+      for (UInt_t i = 0; i < batch.size(); ++i)
+         cursor += batch[i].length;
+   }
+
+   cursor = &data[0];
+   for (UInt_t i = 0; i < ranges.size(); ++i) {
+      fPrefetched[ranges[i].first].assign(cursor, cursor + ranges[i].second);
+      cursor += ranges[i].second;
+   }
+
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::ReadPrefetched(char *buffer, Long64_t position,
+                                   Int_t length)
+{
+   // Serve a read from the prefetched blocks
+   //
+   // param buffer:   where to copy the data, or 0 to only check that the
+   //                 range is available
+   // param position: offset from the beginning of the file
+   // param length:   number of bytes to be read
+   // returns:        kTRUE if a single block holds the whole range
+
+   std::map<Long64_t, std::vector<char> >::iterator it =
+      fPrefetched.upper_bound(position);
+   if (it == fPrefetched.begin())
+      return kFALSE;
+   --it;
+
+   Long64_t offset = position - it->first;
+   if (offset + length > (Long64_t) it->second.size())
+      return kFALSE;
+
+   if (buffer)
+      memcpy(buffer, &it->second[offset], length);
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::BumpReadCounters(Long64_t bytes)
+{
+   // Account for a completed read in the file and global counters. Safe to
+   // call from several threads: the counters are updated atomically, so
+   // that concurrent reads do not contend on a lock.
+
+   __sync_fetch_and_add(&fBytesRead, bytes);
+   __sync_fetch_and_add(&fgBytesRead, bytes);
+   __sync_fetch_and_add(&fReadCalls, 1);
+   __sync_fetch_and_add(&fgReadCalls, 1);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::BumpWriteCounters(Long64_t bytes)
+{
+   // Account for a completed write in the file and global counters. Safe to
+   // call from several threads: the counters are updated atomically.
+
+   __sync_fetch_and_add(&fBytesWrite, bytes);
+   __sync_fetch_and_add(&fgBytesWrite, bytes);
+}
+
+//______________________________________________________________________________
+void TNetXNGFile::WriteFailed()
+{
+   // Account for a failed write, whose data may or may not have reached
+   // the server: the checksums of the data written cannot be trusted
+   // anymore. Safe to call from several threads.
+
+   if (fChecksum)
+      fChecksum->Invalidate();
+}
+
+//______________________________________________________________________________
+XrdCl::OpenFlags::Flags TNetXNGFile::ParseOpenMode(Option_t *modestr)
+{
+   // Parse an file open mode given as a string into an integer that the
+   // client can use
+   //
+   // param option: the file open mode as a string
+   // returns:      correctly parsed option mode
+
+   using namespace XrdCl;
+   OpenFlags::Flags mode = OpenFlags::None;
+   TString mod = ToUpper(TString(modestr));
+
+   if (mod == "NEW" || mod == "CREATE")  mode = OpenFlags::New;
+   else if (mod == "RECREATE")           mode = OpenFlags::Delete;
+   else if (mod == "UPDATE")             mode = OpenFlags::Update;
+   else if (mod == "READ")               mode = OpenFlags::Read;
+
+   return mode;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFile::IsUseable() const
+{
+   // Check the file is open and isn't a zombie
+
+   if (IsZombie()) {
+      Error("TNetXNGFile", "Object is in 'zombie' state");
+      return kFALSE;
+   }
+
+   if (!IsOpen()) {
+      Error("TNetXNGFile", "The remote file is not open");
+      return kFALSE;
+   }
+
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+TNetXNGAsyncOpenHandler::TNetXNGAsyncOpenHandler(TNetXNGFile *file)
+{
+   fFile = file;
+   fFile->SetAsyncOpenStatus(TFile::kAOSInProgress);
+}
+
+//______________________________________________________________________________
+void TNetXNGAsyncOpenHandler::HandleResponse(XrdCl::XRootDStatus *status,
+                                             XrdCl::AnyObject    *response)
+{
+   // Called when a response to associated request arrives or an error occurs
+
+   using namespace XrdCl;
+
+   // Keep the stat information coming with the open response
+   if (status->IsOK() && response) {
+      OpenInfo *info = 0;
+      response->Get(info);
+      if (info && info->GetStatInfo())
+         fFile->SetStatInfo(new StatInfo(*info->GetStatInfo()));
+   }
+
+   delete response;
+   fFile->AsyncOpenDone(*status);
+   delete status;
+   delete this;
 }
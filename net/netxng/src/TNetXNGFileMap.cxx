@@ -0,0 +1,470 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGFileMap                                                             //
+//                                                                            //
+// Read-only memory mapping of a remote XRootD file. Pages are filled lazily  //
+// on first touch through userfaultfd, using vector reads that batch the      //
+// pending faults together with some read-ahead. Only available on Linux     //
+// kernels providing userfaultfd. Pages which cannot be read are made         //
+// inaccessible: touching them raises SIGSEGV rather than returning zeros.   //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGFileMap.h"
+#include "TNetXNGFile.h"
+#include "TError.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifdef __NR_userfaultfd
+#include <linux/userfaultfd.h>
+#define R__HAS_USERFAULTFD
+#endif
+#endif
+
+namespace {
+   const Int_t kDefaultReadAhead = 63;   // Pages fetched after a faulting one
+   const Int_t kMinStagingPages  = 256;  // Pages fetched per cycle at most
+   const Int_t kMaxFaultMsgs     = 64;   // Fault messages drained per read
+   const Int_t kMaxRunLength     = 1 << 30; // Bytes per chunk of a read
+}
+
+//______________________________________________________________________________
+TNetXNGFileMap::TNetXNGFileMap(TNetXNGFile *file, Long64_t size,
+                               Long64_t maxResident, Int_t readAhead) :
+   fFile(file), fSize(size), fAddress(0), fMapSize(0), fPageSize(0),
+   fNPages(0), fMaxResident(0), fReadAhead(readAhead), fUffd(-1),
+   fRunning(kFALSE), fStaging(0), fStagingPages(0), fNFaults(0), fNReads(0),
+   fNEvicted(0), fNErrors(0)
+{
+   // Constructor. The pages are read through the file, so that the reads
+   // follow it when it is re-opened on another replica after a failure.
+   //
+   // param file:        the open file to be mapped, which must outlive the
+   //                    mapping
+   // param size:        size of the remote file
+   // param maxResident: cap on resident memory in bytes, 0 for no cap
+   // param readAhead:   pages fetched after each faulting page, 0 for
+   //                    the default
+
+   fWakePipe[0] = fWakePipe[1] = -1;
+
+   if (fSize <= 0) {
+      ::Error("TNetXNGFileMap", "cannot map an empty file");
+      return;
+   }
+
+#ifdef R__HAS_USERFAULTFD
+   fPageSize = sysconf(_SC_PAGESIZE);
+   fNPages   = (fSize + fPageSize - 1) / fPageSize;
+   fMapSize  = fNPages * fPageSize;
+   if (fReadAhead <= 0) fReadAhead = kDefaultReadAhead;
+
+   // The staging buffer bounds the amount of data fetched per cycle; it must
+   // not exceed the resident cap, otherwise a batch would evict itself
+   fStagingPages = std::max((Long64_t) kMinStagingPages,
+                            (Long64_t) fReadAhead + 1);
+   if (maxResident > 0) {
+      fMaxResident  = std::max((Long64_t) 1, maxResident / fPageSize);
+      fStagingPages = std::min(fStagingPages, fMaxResident);
+   }
+   fStagingPages = std::min(fStagingPages, fNPages);
+
+   fUffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+   if (fUffd < 0) {
+      ::SysError("TNetXNGFileMap", "userfaultfd is not available");
+      return;
+   }
+
+   struct uffdio_api api;
+   memset(&api, 0, sizeof(api));
+   api.api = UFFD_API;
+   if (ioctl(fUffd, UFFDIO_API, &api) < 0) {
+      ::SysError("TNetXNGFileMap", "userfaultfd API handshake failed");
+      return;
+   }
+
+   void *addr = mmap(0, fMapSize, PROT_READ,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (addr == MAP_FAILED) {
+      ::SysError("TNetXNGFileMap", "cannot reserve %lld bytes", fMapSize);
+      return;
+   }
+   fAddress = (char *) addr;
+
+   struct uffdio_register reg;
+   memset(&reg, 0, sizeof(reg));
+   reg.range.start = (unsigned long) fAddress;
+   reg.range.len   = fMapSize;
+   reg.mode        = UFFDIO_REGISTER_MODE_MISSING;
+   if (ioctl(fUffd, UFFDIO_REGISTER, &reg) < 0) {
+      ::SysError("TNetXNGFileMap", "cannot register the mapping");
+      return;
+   }
+
+   void *staging = 0;
+   if (posix_memalign(&staging, fPageSize, fStagingPages * fPageSize)) {
+      ::Error("TNetXNGFileMap", "cannot allocate the staging buffer");
+      return;
+   }
+   fStaging = (char *) staging;
+   fResident.assign(fNPages, 0);
+
+   if (pipe(fWakePipe) < 0) {
+      ::SysError("TNetXNGFileMap", "cannot create the wake-up pipe");
+      return;
+   }
+
+   if (XrdSysThread::Run(&fThread, TNetXNGFileMap::FaultThread, this,
+                         XRDSYSTHREAD_HOLD, "TNetXNGFileMap faults")) {
+      ::Error("TNetXNGFileMap", "cannot start the fault handling thread");
+      return;
+   }
+   fRunning = kTRUE;
+#else
+   ::Error("TNetXNGFileMap", "userfaultfd is not supported on this platform");
+#endif
+}
+
+//______________________________________________________________________________
+TNetXNGFileMap::~TNetXNGFileMap()
+{
+   // Destructor. Stops the fault thread and releases the mapping; the
+   // memory must not be accessed anymore afterwards.
+
+   if (fRunning) {
+      char c = 0;
+      while (write(fWakePipe[1], &c, 1) < 0 && errno == EINTR) {}
+      XrdSysThread::Join(fThread, 0);
+   }
+
+   if (fWakePipe[0] >= 0) close(fWakePipe[0]);
+   if (fWakePipe[1] >= 0) close(fWakePipe[1]);
+   if (fAddress) munmap(fAddress, fMapSize);
+   if (fUffd >= 0) close(fUffd);
+   free(fStaging);
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGFileMap::GetResidentBytes() const
+{
+   // Get the amount of memory currently filled with remote data
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   return (Long64_t) fResidentList.size() * fPageSize;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGFileMap::GetFaults() const
+{
+   // Get the number of pages filled on first touch
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   return fNFaults;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGFileMap::GetReadCalls() const
+{
+   // Get the number of reads issued to fill pages
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   return fNReads;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGFileMap::GetErrors() const
+{
+   // Get the number of faulting pages that could not be read, and were
+   // made inaccessible
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   return fNErrors;
+}
+
+//______________________________________________________________________________
+void *TNetXNGFileMap::FaultThread(void *arg)
+{
+   // Entry point of the fault handling thread
+
+   ((TNetXNGFileMap *) arg)->HandleFaults();
+   return 0;
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::HandleFaults()
+{
+   // Wait for page faults and serve them until asked to stop. All faults
+   // pending at wake-up are drained first, so that they get served by a
+   // single vector read.
+
+#ifdef R__HAS_USERFAULTFD
+   struct pollfd fds[2];
+   fds[0].fd     = fUffd;
+   fds[0].events = POLLIN;
+   fds[1].fd     = fWakePipe[0];
+   fds[1].events = POLLIN;
+
+   struct uffd_msg msgs[kMaxFaultMsgs];
+   std::vector<Long64_t> faults;
+
+   while (true) {
+      if (poll(fds, 2, -1) < 0) {
+         if (errno == EINTR) continue;
+         ::SysError("TNetXNGFileMap", "poll failed, stopping fault handling");
+         return;
+      }
+
+      if (fds[1].revents)
+         return;
+      if (!(fds[0].revents & POLLIN))
+         continue;
+
+      faults.clear();
+      while (true) {
+         ssize_t nread = read(fUffd, msgs, sizeof(msgs));
+         if (nread <= 0)
+            break;
+
+         Int_t nmsgs = nread / sizeof(struct uffd_msg);
+         for (Int_t i = 0; i < nmsgs; ++i) {
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT)
+               continue;
+            char *addr = (char *) msgs[i].arg.pagefault.address;
+            faults.push_back((addr - fAddress) / fPageSize);
+         }
+
+         if (nmsgs < kMaxFaultMsgs)
+            break;
+      }
+
+      if (!faults.empty())
+         FillPages(faults);
+   }
+#endif
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::FillPages(std::vector<Long64_t> &faults)
+{
+   // Serve a set of faulting pages, together with their read-ahead window
+   //
+   // param faults: the faulting page numbers, possibly with duplicates
+
+   std::sort(faults.begin(), faults.end());
+   faults.erase(std::unique(faults.begin(), faults.end()), faults.end());
+
+   // The faulting pages are served in batches of at most fStagingPages:
+   // the kernel does not report a fault again once its message was read, so
+   // none of them may be left behind. In each batch the faulting pages go
+   // first, then the read-ahead of each of them, as long as there is room.
+   UInt_t next = 0;
+   while (next < faults.size()) {
+      std::vector<Long64_t> pages;
+      UInt_t first = next;
+      for (; next < faults.size() &&
+             (Long64_t) pages.size() < fStagingPages; ++next) {
+         if (fResident[faults[next]]) {
+            // Another thread touched it while it was being filled, or it
+            // came with the read-ahead of a previous batch
+            Wake(faults[next]);
+            continue;
+         }
+         pages.push_back(faults[next]);
+      }
+      std::vector<Long64_t> faulting(pages);
+
+      for (UInt_t i = first; i < next; ++i) {
+         for (Long64_t p = faults[i] + 1;
+              p <= faults[i] + fReadAhead && p < fNPages; ++p) {
+            if ((Long64_t) pages.size() >= fStagingPages)
+               break;
+            if (!fResident[p])
+               pages.push_back(p);
+         }
+      }
+
+      if (pages.empty())
+         continue;
+
+      std::sort(pages.begin(), pages.end());
+      pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+      if (fMaxResident) {
+         Long64_t excess = (Long64_t) (fResidentList.size() + pages.size())
+                         - fMaxResident;
+         if (excess > 0)
+            Evict(excess);
+      }
+
+      // The file already tried other replicas. A faulting thread cannot be
+      // handed an error: its pages are made inaccessible, so that it stops
+      // on them rather than reading wrong data; the read-ahead is left out.
+      if (ReadPages(pages)) {
+         CopyPages(pages);
+         continue;
+      }
+      ::Error("TNetXNGFileMap", "cannot read %d pages of %s, touching them "
+              "raises SIGSEGV", (Int_t) faulting.size(), fFile->GetName());
+      {
+         XrdSysMutexHelper lock(fStatsMutex);
+         fNErrors += faulting.size();
+      }
+      FailPages(faulting);
+   }
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGFileMap::ReadPages(const std::vector<Long64_t> &pages)
+{
+   // Read a sorted list of pages into the staging buffer with one vector
+   // read of the file, merging adjacent pages into chunks. The file splits
+   // them according to the server limits.
+   //
+   // param pages: the sorted page numbers, at most fStagingPages of them
+   // returns:     kTRUE in case of success
+
+   // The last page of the file may be short: clear what will not be read
+   if (pages.back() == fNPages - 1) {
+      Long64_t tail = fSize - (fNPages - 1) * fPageSize;
+      memset(fStaging + (pages.size() - 1) * fPageSize + tail, 0,
+             fPageSize - tail);
+   }
+
+   std::vector<Long64_t> positions;
+   std::vector<Int_t>    lengths;
+   UInt_t i = 0;
+   while (i < pages.size()) {
+      UInt_t j = i + 1;
+      while (j < pages.size() && pages[j] == pages[j - 1] + 1) ++j;
+
+      Long64_t offset = pages[i] * fPageSize;
+      Long64_t end    = std::min(fSize, pages[j - 1] * fPageSize + fPageSize);
+      while (offset < end) {
+         Long64_t len = std::min(end - offset, (Long64_t) kMaxRunLength);
+         positions.push_back(offset);
+         lengths.push_back((Int_t) len);
+         offset += len;
+      }
+      i = j;
+   }
+
+   // The data lands back to back in the staging buffer, which matches its
+   // layout since only the last page of the file can be short. Faulting
+   // threads wait for the pages: this is demand for the rate limiter.
+   Bool_t failed = fFile->ReadVector(fStaging, &positions[0], &lengths[0],
+                                     positions.size());
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   ++fNReads;
+   return !failed;
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::CopyPages(const std::vector<Long64_t> &pages)
+{
+   // Install the staged pages into the mapping, waking up the faulting
+   // threads
+   //
+   // param pages: the sorted page numbers that were staged
+
+#ifdef R__HAS_USERFAULTFD
+   UInt_t i = 0;
+   while (i < pages.size()) {
+      UInt_t j = i + 1;
+      while (j < pages.size() && pages[j] == pages[j - 1] + 1) ++j;
+
+      unsigned long dst = (unsigned long) (fAddress + pages[i] * fPageSize);
+      unsigned long len = (j - i) * fPageSize;
+      struct uffdio_copy copy;
+      memset(&copy, 0, sizeof(copy));
+      copy.dst = dst;
+      copy.src = (unsigned long) (fStaging + i * fPageSize);
+      copy.len = len;
+      Int_t rc = ioctl(fUffd, UFFDIO_COPY, &copy);
+
+      if (rc < 0 && errno != EEXIST)
+         ::SysError("TNetXNGFileMap", "cannot install pages at offset %lld",
+                    pages[i] * fPageSize);
+
+      // Make sure nobody stays asleep on a page that was already there
+      if (rc < 0) {
+         for (UInt_t k = i; k < j; ++k)
+            Wake(pages[k]);
+      }
+
+      XrdSysMutexHelper lock(fStatsMutex);
+      for (UInt_t k = i; k < j; ++k) {
+         fResident[pages[k]] = 1;
+         fResidentList.push_back(pages[k]);
+      }
+      fNFaults += j - i;
+      i = j;
+   }
+#endif
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::FailPages(const std::vector<Long64_t> &pages)
+{
+   // Make pages which could not be read inaccessible, then wake up the
+   // threads faulting on them: their access is retried and raises SIGSEGV,
+   // like an I/O error on a mapped local file raises SIGBUS
+   //
+   // param pages: the page numbers
+
+   for (UInt_t i = 0; i < pages.size(); ++i) {
+      if (mprotect(fAddress + pages[i] * fPageSize, fPageSize, PROT_NONE))
+         ::SysError("TNetXNGFileMap", "cannot protect the page at offset "
+                    "%lld", pages[i] * fPageSize);
+      Wake(pages[i]);
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::Evict(Long64_t npages)
+{
+   // Drop the oldest resident pages; touching them again faults them back in
+   //
+   // param npages: the number of pages to drop
+
+   XrdSysMutexHelper lock(fStatsMutex);
+   while (npages-- > 0 && !fResidentList.empty()) {
+      Long64_t page = fResidentList.front();
+      fResidentList.pop_front();
+      madvise(fAddress + page * fPageSize, fPageSize, MADV_DONTNEED);
+      fResident[page] = 0;
+      ++fNEvicted;
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGFileMap::Wake(Long64_t page)
+{
+   // Wake up the threads waiting on a page that is already resident
+   //
+   // param page: the page number
+
+#ifdef R__HAS_USERFAULTFD
+   struct uffdio_range range;
+   range.start = (unsigned long) (fAddress + page * fPageSize);
+   range.len   = fPageSize;
+   ioctl(fUffd, UFFDIO_WAKE, &range);
+#endif
+}
@@ -137,6 +137,25 @@ Int_t TNetXNGFileStager::LocateCollection(TFileCollection *fc,
    return numFiles;
 }
 
+//______________________________________________________________________________
+Int_t TNetXNGFileStager::Prewarm(TCollection *files)
+{
+   // Connect and authenticate to the servers of a list of files in
+   // parallel, ahead of their use (see TNetXNGSystem::Prewarm). With the
+   // list of a TFileCollection on which LocateCollection was called, these
+   // are the data servers holding the files.
+   //
+   // param files: list of files, as TUrl, TObjString or TFileInfo objects
+   // returns:     the number of servers that could not be reached
+
+   if (!files) {
+      Error("Prewarm", "No input collection given");
+      return -1;
+   }
+
+   return fSystem->Prewarm(files);
+}
+
 //______________________________________________________________________________
 Bool_t TNetXNGFileStager::Matches(const char *s)
 {
@@ -156,7 +175,7 @@ Bool_t TNetXNGFileStager::Stage(const char *path, Option_t *opt)
    //             opt = "option=o priority=p"
 
    Int_t priority = ParseStagePriority(opt);
-   return fSystem->Stage(path, priority);
+   return (fSystem->Stage(path, priority) == 0);
 }
 
 //______________________________________________________________________________
@@ -169,7 +188,7 @@ Bool_t TNetXNGFileStager::Stage(TCollection *paths, Option_t *opt)
    //                 format is opt = "option=o priority=p"
 
    Int_t priority = ParseStagePriority(opt);
-   return fSystem->Stage(paths, priority);
+   return (fSystem->Stage(paths, priority) == 0);
 }
 
 //______________________________________________________________________________
@@ -0,0 +1,461 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGInputPipeline                                                       //
+//                                                                            //
+// Opens the next inputs of a list of files read one after the other (e.g.    //
+// by TFileMerger or hadd) ahead of time and fetches their data while the     //
+// current one is processed. The files are then opened as usual, with        //
+// TFile::Open: a TNetXNGFile opened for reading takes over what was fetched  //
+// for its URL.                                                               //
+//                                                                            //
+// Example, merging files while the next 4 inputs are loaded:                 //
+//                                                                            //
+//    TNetXNGInputPipeline pipeline(4);                                       //
+//    pipeline.Add(files);                                                    //
+//    pipeline.Start();                                                       //
+//    TIter next(files);                                                      //
+//    while ((obj = next()))                                                  //
+//       merger.AddFile(((TObjString *) obj)->GetName());                     //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGInputPipeline.h"
+#include "TNetXNGRateLimiter.h"
+#include "TFileStager.h"
+#include "TCollection.h"
+#include "TMath.h"
+#include "TEnv.h"
+#include "TError.h"
+#include <XrdCl/XrdClFile.hh>
+#include <XrdCl/XrdClURL.hh>
+#include <list>
+
+//______________________________________________________________________________
+class TNetXNGInput {
+public:
+   // One file of a pipeline, with what was fetched for it
+   enum EState { kQueued, kLoading, kReady, kTaken, kFailed };
+
+   std::string      fUrl;     // URL to open
+   std::string      fKey;     // Host and path, to match the URL of a file
+   EState           fState;   // Where the input is at
+   XrdCl::File     *fFile;    // Opened file, 0 if it is held in memory
+   XrdCl::StatInfo *fInfo;    // Stat information of the open
+   Long64_t         fBytes;   // Bytes held in fBlocks
+   std::map<Long64_t, std::vector<char> > fBlocks; // Data by offset
+
+   TNetXNGInput(const std::string &url) :
+      fUrl(url), fState(kQueued), fFile(0), fInfo(0), fBytes(0)
+   {
+      XrdCl::URL u(url);
+      fKey = u.GetHostId() + u.GetPath();
+   }
+
+   ~TNetXNGInput()
+   {
+      Drop();
+   }
+
+   void Drop()
+   {
+      // Close the file and release the data
+      if (fFile) {
+         fFile->Close();
+         delete fFile;
+         fFile = 0;
+      }
+      delete fInfo;
+      fInfo  = 0;
+      fBytes = 0;
+      fBlocks.clear();
+   }
+};
+
+namespace {
+   // The pipelines TNetXNGFile looks into
+   XrdSysMutex                        gPipelinesMutex;
+   std::list<TNetXNGInputPipeline *> gPipelines;
+}
+
+//______________________________________________________________________________
+TNetXNGInputPipeline::TNetXNGInputPipeline(Int_t depth, Long64_t maxMemory) :
+   fDepth(depth), fMaxMemory(maxMemory), fMemory(0), fNext(0), fConsumed(0),
+   fStop(kFALSE), fUsers(0), fCond(0)
+{
+   // Constructor
+   //
+   // param depth:     number of inputs opened and loaded ahead of the one
+   //                  in use, 0 for the value of NetXNG.PipelineDepth
+   //                  (default 4)
+   // param maxMemory: max number of bytes held for the inputs not taken yet,
+   //                  0 for the value of NetXNG.PipelineMemory (default
+   //                  256 MB)
+
+   if (fDepth <= 0)
+      fDepth = gEnv->GetValue("NetXNG.PipelineDepth", 4);
+   if (fDepth <= 0)
+      fDepth = 1;
+   if (fMaxMemory <= 0)
+      fMaxMemory = gEnv->GetValue("NetXNG.PipelineMemory", 268435456);
+
+   XrdSysMutexHelper lock(gPipelinesMutex);
+   gPipelines.push_back(this);
+}
+
+//______________________________________________________________________________
+TNetXNGInputPipeline::~TNetXNGInputPipeline()
+{
+   // Destructor. Waits for the inputs being loaded, then closes the files
+   // and releases the data which were not taken.
+
+   {
+      XrdSysMutexHelper lock(gPipelinesMutex);
+      gPipelines.remove(this);
+   }
+
+   // Files may still be waiting for inputs being loaded
+   fCond.Lock();
+   fStop = kTRUE;
+   fCond.Broadcast();
+   while (fUsers)
+      fCond.Wait();
+   fCond.UnLock();
+
+   for (UInt_t i = 0; i < fThreads.size(); ++i)
+      XrdSysThread::Join(fThreads[i], 0);
+   for (UInt_t i = 0; i < fInputs.size(); ++i)
+      delete fInputs[i];
+}
+
+//______________________________________________________________________________
+void TNetXNGInputPipeline::Add(const char *url)
+{
+   // Append a file to the inputs, before Start()
+   //
+   // param url: URL of the file, as it is going to be opened
+
+   XrdSysCondVarHelper lock(fCond);
+   if (!fThreads.empty()) {
+      ::Error("TNetXNGInputPipeline::Add", "the pipeline is already started");
+      return;
+   }
+   fInputs.push_back(new TNetXNGInput(url));
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGInputPipeline::Add(TCollection *files)
+{
+   // Append files to the inputs, before Start()
+   //
+   // param files: the files, as TUrl, TObjString or TFileInfo objects
+   // returns:     the number of files added
+
+   Int_t n = 0;
+   TIter it(files);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         ::Warning("TNetXNGInputPipeline::Add",
+                   "object is of unexpected type %s - ignoring",
+                   object->ClassName());
+         continue;
+      }
+      Add(path.Data());
+      ++n;
+   }
+   return n;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGInputPipeline::Start()
+{
+   // Start loading the inputs, one thread per input loaded ahead
+   //
+   // returns: kFALSE if no thread could be started
+
+   XrdSysCondVarHelper lock(fCond);
+   if (!fThreads.empty())
+      return kTRUE;
+
+   Int_t nthreads = TMath::Min(fDepth, (Int_t) fInputs.size());
+   for (Int_t i = 0; i < nthreads; ++i) {
+      pthread_t tid;
+      if (XrdSysThread::Run(&tid, TNetXNGInputPipeline::LoadThread, this,
+                            XRDSYSTHREAD_HOLD, "TNetXNGInputPipeline")) {
+         ::Error("TNetXNGInputPipeline::Start", "cannot start a thread");
+         break;
+      }
+      fThreads.push_back(tid);
+   }
+   return nthreads == 0 || !fThreads.empty();
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGInputPipeline::GetNInputs() const
+{
+   // Get the number of inputs
+
+   XrdSysCondVarHelper lock(fCond);
+   return fInputs.size();
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGInputPipeline::GetNReady() const
+{
+   // Get the number of inputs loaded and not taken yet
+
+   XrdSysCondVarHelper lock(fCond);
+   Int_t n = 0;
+   for (UInt_t i = 0; i < fInputs.size(); ++i)
+      if (fInputs[i]->fState == TNetXNGInput::kReady)
+         ++n;
+   return n;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGInputPipeline::GetMemory() const
+{
+   // Get the number of bytes held for the inputs not taken yet
+
+   XrdSysCondVarHelper lock(fCond);
+   return fMemory;
+}
+
+//______________________________________________________________________________
+void *TNetXNGInputPipeline::LoadThread(void *arg)
+{
+   // Body of the loading threads: load the inputs in order, never more than
+   // fDepth of them ahead of the ones taken
+
+   TNetXNGInputPipeline *pipeline = (TNetXNGInputPipeline *) arg;
+   XrdSysCondVar        &cond     = pipeline->fCond;
+
+   cond.Lock();
+   while (!pipeline->fStop &&
+          pipeline->fNext < (Int_t) pipeline->fInputs.size()) {
+      Int_t next = pipeline->fNext;
+      if (next >= pipeline->fConsumed + pipeline->fDepth) {
+         cond.Wait();
+         continue;
+      }
+
+      TNetXNGInput *input = pipeline->fInputs[next];
+      ++pipeline->fNext;
+      if (input->fState != TNetXNGInput::kQueued)
+         continue;
+      input->fState = TNetXNGInput::kLoading;
+      cond.UnLock();
+
+      pipeline->Load(input);
+
+      cond.Lock();
+      cond.Broadcast();
+   }
+   cond.UnLock();
+   return 0;
+}
+
+//______________________________________________________________________________
+void TNetXNGInputPipeline::Load(TNetXNGInput *input)
+{
+   // Open an input and fetch its data: the whole file if it fits in the
+   // memory left, otherwise its beginning and end, which hold what
+   // TFile::Init reads (see TNetXNGFile::PrefetchInit), or nothing if
+   // they do not fit either. The file is kept open in the latter cases.
+   // The requests go at bulk priority, behind the reads of the input in
+   // use.
+
+   using namespace XrdCl;
+
+   File        *file = new File();
+   StatInfo    *info = 0;
+   XRootDStatus st;
+   {
+      TNetXNGRateGuard guard(URL(input->fUrl).GetHostId(), 0,
+                             TNetXNGRateLimiter::kMetadata);
+      st = file->Open(input->fUrl, OpenFlags::Read);
+      if (st.IsOK())
+         st = file->Stat(false, info);
+   }
+
+   Long64_t size = (st.IsOK() && info) ? (Long64_t) info->GetSize() : -1;
+   std::vector<std::pair<Long64_t, Long64_t> > ranges;
+   Bool_t whole = kFALSE;
+   Long64_t bytes = 0;
+   if (size > 0) {
+      XrdSysCondVarHelper lock(fCond);
+      if (fMemory + size <= fMaxMemory) {
+         whole = kTRUE;
+         ranges.push_back(std::make_pair(0LL, size));
+      } else {
+         Long64_t head = gEnv->GetValue("NetXNG.PrefetchHead", 65536);
+         Long64_t tail = gEnv->GetValue("NetXNG.PrefetchTail", 524288);
+         if (head + tail >= size) {
+            head = size;
+            tail = 0;
+         }
+         if (head > 0) ranges.push_back(std::make_pair(0LL, head));
+         if (tail > 0) ranges.push_back(std::make_pair(size - tail, tail));
+      }
+      for (UInt_t i = 0; i < ranges.size(); ++i)
+         bytes += ranges[i].second;
+
+      // Without room for the blocks either, the input is only opened
+      if (fMemory + bytes > fMaxMemory) {
+         ranges.clear();
+         bytes = 0;
+      }
+      fMemory += bytes;
+   }
+
+   std::map<Long64_t, std::vector<char> > blocks;
+   for (UInt_t i = 0; st.IsOK() && i < ranges.size(); ++i) {
+      std::vector<char> &data = blocks[ranges[i].first];
+      data.resize(ranges[i].second);
+      uint32_t bytesRead = 0;
+      TNetXNGRateGuard guard(file, ranges[i].second,
+                             TNetXNGRateLimiter::kBulk);
+      st = file->Read(ranges[i].first, ranges[i].second, &data[0],
+                      bytesRead);
+      if (st.IsOK() && bytesRead != ranges[i].second)
+         st = XRootDStatus(stError, errDataError);
+   }
+
+   if (st.IsOK() && whole) {
+      file->Close();
+      delete file;
+      file = 0;
+   }
+
+   XrdSysCondVarHelper lock(fCond);
+   if (!st.IsOK()) {
+      if (gDebug > 0)
+         ::Info("TNetXNGInputPipeline::Load", "%s: %s", input->fUrl.c_str(),
+                st.ToStr().c_str());
+      fMemory -= bytes;
+      input->fState = TNetXNGInput::kFailed;
+      if (file) file->Close();
+      delete file;
+      delete info;
+      return;
+   }
+
+   input->fFile  = file;
+   input->fInfo  = info;
+   input->fBytes = bytes;
+   input->fBlocks.swap(blocks);
+   input->fState = TNetXNGInput::kReady;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGInputPipeline::Take(const std::string &url, XrdCl::File *&file,
+                                  XrdCl::StatInfo *&info,
+                                  std::map<Long64_t, std::vector<char> >
+                                  &blocks)
+{
+   // Hand what was fetched for a URL over to the TNetXNGFile opening it,
+   // waiting for it if it is being loaded. Called by TNetXNGFile only.
+   //
+   // param url:    URL of the file opened for reading
+   // param file:   the open file, or 0 if the whole file is in the blocks
+   //               (out, owned by the caller)
+   // param info:   stat information of the open (out, owned by the caller)
+   // param blocks: data of the file by offset (out)
+   // returns:      kFALSE if no pipeline holds an input for this URL
+
+   XrdCl::URL u(url);
+   std::string key = u.GetHostId() + u.GetPath();
+
+   // Find the pipeline under the global lock, then wait for the input
+   // without it: the pipeline cannot go away while it is held
+   TNetXNGInputPipeline *pipeline = 0;
+   {
+      XrdSysMutexHelper lock(gPipelinesMutex);
+      std::list<TNetXNGInputPipeline *>::iterator it;
+      for (it = gPipelines.begin(); it != gPipelines.end() && !pipeline; ++it)
+         if ((*it)->Hold(key))
+            pipeline = *it;
+   }
+   if (!pipeline)
+      return kFALSE;
+
+   Bool_t taken = pipeline->TakeInput(key, file, info, blocks);
+
+   XrdSysCondVarHelper lock(pipeline->fCond);
+   --pipeline->fUsers;
+   pipeline->fCond.Broadcast();
+   return taken;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGInputPipeline::Hold(const std::string &key)
+{
+   // Check if an input with a key may still be taken and if so, keep the
+   // pipeline from being deleted until the file is done waiting for it
+   //
+   // returns: kTRUE if the pipeline is held
+
+   XrdSysCondVarHelper lock(fCond);
+   for (UInt_t i = 0; i < fInputs.size(); ++i) {
+      TNetXNGInput *input = fInputs[i];
+      if (input->fKey == key && input->fState != TNetXNGInput::kTaken &&
+          input->fState != TNetXNGInput::kFailed) {
+         ++fUsers;
+         return kTRUE;
+      }
+   }
+   return kFALSE;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGInputPipeline::TakeInput(const std::string &key,
+                                       XrdCl::File *&file,
+                                       XrdCl::StatInfo *&info,
+                                       std::map<Long64_t,
+                                                std::vector<char> > &blocks)
+{
+   // Hand the first input with a key over, see Take(). An input not loaded
+   // yet is skipped: the file is opened as if there was no pipeline.
+
+   XrdSysCondVarHelper lock(fCond);
+   for (UInt_t i = 0; i < fInputs.size(); ++i) {
+      TNetXNGInput *input = fInputs[i];
+      if (input->fKey != key || input->fState == TNetXNGInput::kTaken ||
+          input->fState == TNetXNGInput::kFailed)
+         continue;
+
+      while (input->fState == TNetXNGInput::kLoading)
+         fCond.Wait();
+
+      // Let the threads move on past this input
+      if ((Int_t) i + 1 > fConsumed) {
+         fConsumed = i + 1;
+         fCond.Broadcast();
+      }
+
+      if (input->fState != TNetXNGInput::kReady) {
+         input->fState = TNetXNGInput::kTaken;
+         return kFALSE;
+      }
+
+      file          = input->fFile;
+      info          = input->fInfo;
+      input->fFile  = 0;
+      input->fInfo  = 0;
+      blocks.swap(input->fBlocks);
+      fMemory      -= input->fBytes;
+      input->Drop();
+      input->fState = TNetXNGInput::kTaken;
+      return kTRUE;
+   }
+   return kFALSE;
+}
@@ -0,0 +1,252 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRace                                                                //
+//                                                                            //
+// Internal helper sending the same request to several equivalent entry       //
+// points (redirectors of the same namespace, listed in NetXNG.Redirectors)   //
+// at the same time and keeping the first successful answer. The latency of   //
+// each entry point is remembered, so that the fastest ones are raced first.  //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGRace.h"
+#include "TNetXNGTrace.h"
+#include "TEnv.h"
+#include "TString.h"
+#include "TMath.h"
+#include <XrdCl/XrdClURL.hh>
+#include <algorithm>
+#include <map>
+
+namespace {
+   // Latency charged to an entry point for a failed request, in us
+   const Long64_t kFailureLatency = 10000000;
+
+   // Smoothed latency of the entry points, by host:port
+   XrdSysMutex                     gLatencyMutex;
+   std::map<std::string, Long64_t> gLatency;
+
+   //___________________________________________________________________________
+   std::string GetHostPort(const XrdCl::URL &url)
+   {
+      // Identify an entry point independently of the user name
+
+      int port = url.GetPort();
+      return url.GetHostName() + ":" + TString::Format("%d", port > 0 ?
+                                                       port : 1094).Data();
+   }
+
+   //___________________________________________________________________________
+   bool FasterThan(const std::pair<Long64_t, std::string> &a,
+                   const std::pair<Long64_t, std::string> &b)
+   {
+      return a.first < b.first;
+   }
+}
+
+//______________________________________________________________________________
+class TNetXNGRaceLeg: public XrdCl::ResponseHandler {
+private:
+   TNetXNGRace *fRace;  // The race the request is part of
+   Int_t        fIndex; // Entry point the request went to
+
+public:
+   TNetXNGRaceLeg(TNetXNGRace *race, Int_t index) :
+      fRace(race), fIndex(index) {}
+
+   virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                               XrdCl::AnyObject    *response)
+   {
+      fRace->Answer(fIndex, status, response);
+      delete this;
+   }
+};
+
+//______________________________________________________________________________
+Bool_t TNetXNGRace::GetEntryPoints(const XrdCl::URL &url,
+                                   std::vector<std::string> &hosts)
+{
+   // Get the entry points to race for a URL. NetXNG.Redirectors lists
+   // equivalent entry points as host[:port], separated by spaces or commas;
+   // if the host of the URL is one of them, the NetXNG.RedirectorRace
+   // (default 2) fastest of them are raced. Those never used come first, so
+   // that their latency gets known.
+   //
+   // param url:   the URL the request would be sent to
+   // param hosts: the entry points, as host:port, fastest first (out)
+   // returns:     kFALSE if the host of the URL is not listed
+
+   const char *list = gEnv->GetValue("NetXNG.Redirectors", "");
+   if (!*list)
+      return kFALSE;
+
+   std::string self = GetHostPort(url);
+   Bool_t      listed = kFALSE;
+   std::vector<std::pair<Long64_t, std::string> > ranked;
+   std::string entries(list);
+   std::string::size_type begin = 0, end = 0;
+   {
+      XrdSysMutexHelper lock(gLatencyMutex);
+      while ((begin = entries.find_first_not_of(" ,", end)) !=
+             std::string::npos) {
+         end = entries.find_first_of(" ,", begin);
+         std::string host = GetHostPort(XrdCl::URL("root://" +
+                                        entries.substr(begin, end - begin) +
+                                        "/"));
+         if (host == self)
+            listed = kTRUE;
+         std::map<std::string, Long64_t>::iterator it = gLatency.find(host);
+         ranked.push_back(std::make_pair(it == gLatency.end() ? -1 :
+                                         it->second, host));
+      }
+   }
+   if (!listed)
+      return kFALSE;
+
+   std::stable_sort(ranked.begin(), ranked.end(), FasterThan);
+   Int_t n = TMath::Max(1, gEnv->GetValue("NetXNG.RedirectorRace", 2));
+   hosts.clear();
+   for (UInt_t i = 0; i < ranked.size() && (Int_t) hosts.size() < n; ++i)
+      if (std::find(hosts.begin(), hosts.end(), ranked[i].second) ==
+          hosts.end())
+         hosts.push_back(ranked[i].second);
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGRace::Record(const std::string &host, Long64_t latency)
+{
+   // Account for the answer of an entry point
+   //
+   // param host:    the entry point, as host:port
+   // param latency: time it took to answer in us, -1 if it failed
+
+   if (latency < 0)
+      latency = kFailureLatency;
+
+   XrdSysMutexHelper lock(gLatencyMutex);
+   std::map<std::string, Long64_t>::iterator it = gLatency.find(host);
+   if (it == gLatency.end())
+      gLatency[host] = latency;
+   else
+      it->second = (3 * it->second + latency) / 4;
+}
+
+//______________________________________________________________________________
+TNetXNGRace::TNetXNGRace(const std::vector<std::string> &hosts) :
+   fCond(0), fHosts(hosts), fStart(0), fRefs(1), fNFailed(0), fWinner(-1),
+   fResponse(0)
+{
+   // Constructor. The race deletes itself once Release() was called and
+   // all the answers arrived.
+   //
+   // param hosts: the entry points to race, as host:port
+}
+
+//______________________________________________________________________________
+TNetXNGRace::~TNetXNGRace()
+{
+   // Destructor
+
+   delete fResponse;
+}
+
+//______________________________________________________________________________
+XrdCl::XRootDStatus TNetXNGRace::Run(Int_t &winner,
+                                     XrdCl::AnyObject *&response)
+{
+   // Send the request to all the entry points and wait for the first one
+   // to succeed, or for all of them to fail. XrdCl cannot cancel requests:
+   // the answers of the others are handed over to Lost() when they come.
+   //
+   // param winner:   the entry point which answered first, -1 if all
+   //                 failed (out)
+   // param response: the response of the winner, owned by the caller (out)
+   // returns:        the status of the winner, or one of the errors
+
+   Int_t n = fHosts.size();
+   {
+      XrdSysCondVarHelper lock(fCond);
+      fStart = TNetXNGTrace::Now();
+      fRefs += n;
+   }
+
+   for (Int_t i = 0; i < n; ++i) {
+      TNetXNGRaceLeg *leg = new TNetXNGRaceLeg(this, i);
+      XrdCl::XRootDStatus st = Send(i, leg);
+      if (!st.IsOK()) {
+         delete leg;
+         Answer(i, new XrdCl::XRootDStatus(st), 0);
+      }
+   }
+
+   XrdSysCondVarHelper lock(fCond);
+   while (fWinner < 0 && fNFailed < n)
+      fCond.Wait();
+   winner    = fWinner;
+   response  = fResponse;
+   fResponse = 0;
+   return fStatus;
+}
+
+//______________________________________________________________________________
+void TNetXNGRace::Release()
+{
+   // Give the race up, once done with the winner
+
+   Bool_t last;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      last = (--fRefs == 0);
+   }
+   if (last)
+      delete this;
+}
+
+//______________________________________________________________________________
+void TNetXNGRace::Answer(Int_t i, XrdCl::XRootDStatus *status,
+                         XrdCl::AnyObject *response)
+{
+   // Handle the answer of an entry point: the first success wins, the
+   // others are lost
+
+   Long64_t latency = TNetXNGTrace::Now() - fStart;
+   Bool_t   won = kFALSE;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      if (status->IsOK() && fWinner < 0) {
+         fWinner   = i;
+         fStatus   = *status;
+         fResponse = response;
+         won       = kTRUE;
+      } else if (!status->IsOK()) {
+         ++fNFailed;
+         if (fWinner < 0)
+            fStatus = *status;
+      }
+      fCond.Broadcast();
+   }
+
+   Record(fHosts[i], status->IsOK() ? latency : -1);
+   if (!won) {
+      Lost(i, *status, response);
+      delete response;
+   }
+   delete status;
+
+   Bool_t last;
+   {
+      XrdSysCondVarHelper lock(fCond);
+      last = (--fRefs == 0);
+   }
+   if (last)
+      delete this;
+}
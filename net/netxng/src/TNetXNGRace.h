@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGRace
+#define ROOT_TNetXNGRace
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRace                                                                //
+//                                                                            //
+// Internal helper sending the same request to several equivalent entry       //
+// points (redirectors of the same namespace, listed in NetXNG.Redirectors)   //
+// at the same time and keeping the first successful answer. The latency of   //
+// each entry point is remembered, so that the fastest ones are raced first.  //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include <XrdSys/XrdSysPthread.hh>
+#include <XrdCl/XrdClXRootDResponses.hh>
+#include <string>
+#include <vector>
+
+namespace XrdCl {
+   class URL;
+}
+
+class TNetXNGRace {
+private:
+   XrdSysCondVar            fCond;     // Protects the members below
+   std::vector<std::string> fHosts;    // Entry points raced, as host:port
+   Long64_t                 fStart;    // When the requests were sent
+   Int_t                    fRefs;     // Answers to come, plus the caller
+   Int_t                    fNFailed;  // Requests which failed
+   Int_t                    fWinner;   // First to succeed, -1 until then
+   XrdCl::XRootDStatus      fStatus;   // Status of the winner, or an error
+   XrdCl::AnyObject        *fResponse; // Response of the winner
+
+public:
+   static Bool_t GetEntryPoints(const XrdCl::URL &url,
+                                std::vector<std::string> &hosts);
+   static void   Record(const std::string &host, Long64_t latency);
+
+   TNetXNGRace(const std::vector<std::string> &hosts);
+
+   XrdCl::XRootDStatus Run(Int_t &winner, XrdCl::AnyObject *&response);
+   void                Release();
+
+   const std::string  &GetHost(Int_t i) const { return fHosts[i]; }
+
+protected:
+   virtual ~TNetXNGRace();
+
+   // Send the request to entry point i asynchronously, with the handler
+   virtual XrdCl::XRootDStatus Send(Int_t i,
+                                    XrdCl::ResponseHandler *handler) = 0;
+
+   // Called for every request which did not win, as its answer arrives (or
+   // right away if it could not be sent); the response is deleted after.
+   // May be called from an XrdCl thread after Run() returned.
+   virtual void Lost(Int_t /*i*/, const XrdCl::XRootDStatus & /*status*/,
+                     XrdCl::AnyObject * /*response*/) {}
+
+private:
+   void Answer(Int_t i, XrdCl::XRootDStatus *status,
+               XrdCl::AnyObject *response);
+
+   TNetXNGRace(const TNetXNGRace &other);             // Not implemented
+   TNetXNGRace &operator =(const TNetXNGRace &other); // Not implemented
+
+   friend class TNetXNGRaceLeg;
+};
+
+#endif // ROOT_TNetXNGRace
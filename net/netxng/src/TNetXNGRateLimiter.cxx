@@ -0,0 +1,369 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRateLimiter                                                         //
+//                                                                            //
+// Schedules the requests of all the TNetXNGFile and TNetXNGSystem objects   //
+// of the process. Each request has a priority class: metadata, demand        //
+// (a thread waits for it), prefetch or bulk (copies, staging). Requests are  //
+// limited in bytes per second (token bucket) and in number in flight,        //
+// overall and per data server, and the bytes of prefetch and bulk requests   //
+// in flight are capped; waiting requests go in the order of their classes.   //
+// Prefetches never wait: they are dropped when they cannot go right away.    //
+// See Configure() for the settings.                                          //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGRateLimiter.h"
+#include "TEnv.h"
+#include "TMath.h"
+#include <XrdCl/XrdClFile.hh>
+#include <XrdSys/XrdSysPthread.hh>
+#include <map>
+#include <sys/time.h>
+
+Bool_t TNetXNGRateLimiter::fgEnabled = kFALSE;
+
+namespace {
+
+   // A token bucket and a count of requests in flight. The level may go
+   // negative: a request larger than the bucket is let through once the
+   // level is positive, and the next ones wait for the debt to be paid.
+   struct TNetXNGBucket {
+      Double_t fRate;        // Bytes per second, 0 = unlimited
+      Double_t fBurst;       // Capacity of the bucket, in bytes
+      Double_t fLevel;       // Bytes which may be sent right away
+      Double_t fLast;        // When the level was last updated
+      Int_t    fMaxRequests; // Max requests in flight, 0 = unlimited
+      Int_t    fInFlight;    // Requests in flight
+
+      TNetXNGBucket() : fRate(0), fBurst(0), fLevel(0), fLast(0),
+                        fMaxRequests(0), fInFlight(0) {}
+   };
+
+   XrdSysCondVar                        gLimiterCond(0);     // Protects
+                                                             // what follows
+   TNetXNGBucket                        gProcessBucket;      // Whole process
+   std::map<std::string, TNetXNGBucket> gHostBuckets;        // Per server
+   Double_t                             gHostRate = 0;       // Server limits
+   Int_t                                gHostRequests = 0;
+   Double_t                             gBurstTime = 0.25;   // Seconds
+   Double_t                             gPrefetchShare = 0.5;
+   Long64_t                             gMaxLowBytes = 0;    // Low priority
+   Long64_t                             gLowBytes = 0;       // bytes in
+                                                             // flight
+   Long64_t                             gNDelayed = 0;       // Statistics
+   Long64_t                             gNRefused = 0;
+
+   // Requests blocked, per class
+   Int_t gWaiting[TNetXNGRateLimiter::kNPriorities];
+
+   //___________________________________________________________________________
+   Bool_t IsLowPriority(TNetXNGRateLimiter::EPriority priority)
+   {
+      // Prefetch and bulk requests are the ones throttled first
+
+      return priority == TNetXNGRateLimiter::kPrefetch ||
+             priority == TNetXNGRateLimiter::kBulk;
+   }
+
+   //___________________________________________________________________________
+   Double_t Now()
+   {
+      // Current time in seconds
+
+      struct timeval tv;
+      gettimeofday(&tv, 0);
+      return tv.tv_sec + tv.tv_usec * 1e-6;
+   }
+
+   //___________________________________________________________________________
+   void SetBucket(TNetXNGBucket &bucket, Double_t rate, Int_t maxRequests)
+   {
+      // Set the limits of a bucket, which starts full
+
+      bucket.fRate        = rate > 0 ? rate : 0;
+      bucket.fBurst       = bucket.fRate * gBurstTime;
+      bucket.fLevel       = bucket.fBurst;
+      bucket.fLast        = Now();
+      bucket.fMaxRequests = maxRequests > 0 ? maxRequests : 0;
+   }
+
+   //___________________________________________________________________________
+   Double_t Admit(TNetXNGBucket &bucket, Double_t now,
+                  TNetXNGRateLimiter::EPriority priority)
+   {
+      // Check if a request may be sent within the limits of a bucket. Demand
+      // and metadata may use all the bucket, prefetch and bulk requests only
+      // the share of it given by NetXNG.PrefetchShare, so that they are
+      // throttled first.
+      //
+      // returns: 0 if it may, else the time to wait in seconds, or -1 if a
+      //          request in flight has to complete first
+
+      Double_t share = IsLowPriority(priority) ? gPrefetchShare : 1;
+
+      if (bucket.fMaxRequests &&
+          bucket.fInFlight >= TMath::Max(1., share * bucket.fMaxRequests))
+         return -1;
+
+      if (bucket.fRate > 0) {
+         bucket.fLevel = TMath::Min(bucket.fBurst, bucket.fLevel +
+                                    (now - bucket.fLast) * bucket.fRate);
+         bucket.fLast  = now;
+         Double_t reserve = (1 - share) * bucket.fBurst;
+         if (bucket.fLevel < reserve)
+            return (reserve - bucket.fLevel) / bucket.fRate;
+      }
+      return 0;
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGRateLimiter::Configure()
+{
+   // Apply the settings of the limiter, the first time only. Called when
+   // files are created.
+   //
+   //    NetXNG.RateLimit         bytes per second of the process (0)
+   //    NetXNG.MaxRequests       requests in flight of the process (0)
+   //    NetXNG.HostRateLimit     bytes per second per data server (0)
+   //    NetXNG.MaxHostRequests   requests in flight per data server (0)
+   //    NetXNG.RateBurst         seconds of transfer a bucket holds (0.25)
+   //    NetXNG.PrefetchShare     part of the limits prefetch and bulk
+   //                             requests may use (0.5)
+   //    NetXNG.MaxLowPriorityBytes
+   //                             bytes of prefetch and bulk requests in
+   //                             flight (0)
+   //
+   // 0 means no limit.
+
+   static Bool_t configured = kFALSE;
+   {
+      XrdSysCondVarHelper lock(gLimiterCond);
+      if (configured)
+         return;
+      configured = kTRUE;
+      gBurstTime = gEnv->GetValue("NetXNG.RateBurst", 0.25);
+      if (gBurstTime <= 0)
+         gBurstTime = 0.25;
+      gPrefetchShare = gEnv->GetValue("NetXNG.PrefetchShare", 0.5);
+      gPrefetchShare = TMath::Max(0., TMath::Min(1., gPrefetchShare));
+   }
+
+   SetLimits(gEnv->GetValue("NetXNG.RateLimit", 0.),
+             gEnv->GetValue("NetXNG.MaxRequests", 0),
+             gEnv->GetValue("NetXNG.HostRateLimit", 0.),
+             gEnv->GetValue("NetXNG.MaxHostRequests", 0),
+             (Long64_t) gEnv->GetValue("NetXNG.MaxLowPriorityBytes", 0.));
+}
+
+//______________________________________________________________________________
+void TNetXNGRateLimiter::SetLimits(Double_t rate, Int_t maxRequests,
+                                   Double_t hostRate, Int_t maxHostRequests,
+                                   Long64_t maxLowBytes)
+{
+   // Change the limits; 0 means no limit
+   //
+   // param rate:            bytes per second of the process
+   // param maxRequests:     requests in flight of the process
+   // param hostRate:        bytes per second per data server
+   // param maxHostRequests: requests in flight per data server
+   // param maxLowBytes:     bytes of prefetch and bulk requests in flight
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   SetBucket(gProcessBucket, rate, maxRequests);
+   gHostRate     = hostRate > 0 ? hostRate : 0;
+   gHostRequests = maxHostRequests > 0 ? maxHostRequests : 0;
+   std::map<std::string, TNetXNGBucket>::iterator it;
+   for (it = gHostBuckets.begin(); it != gHostBuckets.end(); ++it)
+      SetBucket(it->second, gHostRate, gHostRequests);
+
+   gMaxLowBytes  = maxLowBytes > 0 ? maxLowBytes : 0;
+
+   fgEnabled = rate > 0 || maxRequests > 0 || hostRate > 0 ||
+               maxHostRequests > 0 || maxLowBytes > 0;
+   gLimiterCond.Broadcast();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGRateLimiter::Acquire(const char *host, Long64_t bytes,
+                                   EPriority priority)
+{
+   // Get the permission to send a request; Release() must be called once
+   // it completed. Requests wait until the limits allow them and no request
+   // of a higher class is waiting, which may block the calling thread. A
+   // prefetch or bulk request larger than NetXNG.MaxLowPriorityBytes goes
+   // alone. Prefetches never wait: they are refused when they cannot go
+   // right away.
+   //
+   // param host:     the data server (host:port) the request goes to
+   // param bytes:    the size of the transfer
+   // param priority: the class of the request
+   // returns:        kTRUE if the request may be sent
+
+   if (!fgEnabled)
+      return kTRUE;
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   TNetXNGBucket *hostBucket = 0;
+   if ((gHostRate > 0 || gHostRequests > 0) && host && *host) {
+      std::map<std::string, TNetXNGBucket>::iterator it =
+         gHostBuckets.find(host);
+      if (it == gHostBuckets.end()) {
+         it = gHostBuckets.insert(std::make_pair(std::string(host),
+                                                 TNetXNGBucket())).first;
+         SetBucket(it->second, gHostRate, gHostRequests);
+      }
+      hostBucket = &it->second;
+   }
+
+   Bool_t low    = IsLowPriority(priority);
+   Bool_t waited = kFALSE;
+   ++gWaiting[priority];
+   while (true) {
+      Double_t now  = Now();
+      Double_t wait = Admit(gProcessBucket, now, priority);
+      if (hostBucket) {
+         Double_t hostWait = Admit(*hostBucket, now, priority);
+         wait = (wait < 0 || hostWait < 0) ? -1 : TMath::Max(wait, hostWait);
+      }
+      for (Int_t p = 0; p < priority; ++p)
+         if (gWaiting[p])
+            wait = -1;
+      if (low && gMaxLowBytes && gLowBytes &&
+          gLowBytes + bytes > gMaxLowBytes)
+         wait = -1;
+      if (wait == 0)
+         break;
+
+      if (priority == kPrefetch) {
+         --gWaiting[priority];
+         ++gNRefused;
+         return kFALSE;
+      }
+
+      // Woken up by Release() when waiting for a request in flight
+      waited = kTRUE;
+      gLimiterCond.WaitMS(wait < 0 ? 100 :
+                          (Int_t) TMath::Min(1000., wait * 1000 + 1));
+   }
+   --gWaiting[priority];
+   if (waited)
+      ++gNDelayed;
+
+   // The requests of the lower classes may have been held by this one
+   if (gWaiting[kDemand] + gWaiting[kBulk])
+      gLimiterCond.Broadcast();
+
+   if (low)
+      gLowBytes += bytes;
+   gProcessBucket.fLevel -= bytes;
+   ++gProcessBucket.fInFlight;
+   if (hostBucket) {
+      hostBucket->fLevel -= bytes;
+      ++hostBucket->fInFlight;
+   }
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGRateLimiter::Release(const char *host, Long64_t bytes,
+                                 EPriority priority)
+{
+   // Account for the completion of a request sent after Acquire()
+   //
+   // param host:     the data server given to Acquire()
+   // param bytes:    the size given to Acquire()
+   // param priority: the class given to Acquire()
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   if (IsLowPriority(priority))
+      gLowBytes = TMath::Max(0LL, gLowBytes - bytes);
+   if (gProcessBucket.fInFlight > 0)
+      --gProcessBucket.fInFlight;
+   if (host && *host) {
+      std::map<std::string, TNetXNGBucket>::iterator it =
+         gHostBuckets.find(host);
+      if (it != gHostBuckets.end() && it->second.fInFlight > 0)
+         --it->second.fInFlight;
+   }
+   gLimiterCond.Broadcast();
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGRateLimiter::GetNDelayed()
+{
+   // Get the number of demand requests which had to wait
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   return gNDelayed;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGRateLimiter::GetNRefused()
+{
+   // Get the number of prefetches which were refused
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   return gNRefused;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGRateLimiter::GetLowBytesInFlight()
+{
+   // Get the number of bytes of prefetch and bulk requests in flight
+
+   XrdSysCondVarHelper lock(gLimiterCond);
+   return gLowBytes;
+}
+
+//______________________________________________________________________________
+TNetXNGRateGuard::TNetXNGRateGuard(const XrdCl::File *file, Long64_t bytes,
+                                   TNetXNGRateLimiter::EPriority priority) :
+   fBytes(bytes), fPriority(priority), fHeld(kFALSE)
+{
+   // Wait for the limiter to allow a transfer with the data server of the
+   // file
+   //
+   // param file:     the file the request goes to
+   // param bytes:    the size of the transfer
+   // param priority: the class of the request, which should not be
+   //                 kPrefetch as the guard cannot be refused
+
+   if (!TNetXNGRateLimiter::IsEnabled())
+      return;
+   fHost = file->GetDataServer();
+   fHeld = TNetXNGRateLimiter::Acquire(fHost.c_str(), fBytes, fPriority);
+}
+
+//______________________________________________________________________________
+TNetXNGRateGuard::TNetXNGRateGuard(const std::string &host, Long64_t bytes,
+                                   TNetXNGRateLimiter::EPriority priority) :
+   fHost(host), fBytes(bytes), fPriority(priority), fHeld(kFALSE)
+{
+   // Wait for the limiter to allow a request to a server
+   //
+   // param host:     the server (host:port) the request goes to
+   // param bytes:    the size of the transfer
+   // param priority: the class of the request
+
+   if (TNetXNGRateLimiter::IsEnabled())
+      fHeld = TNetXNGRateLimiter::Acquire(fHost.c_str(), fBytes, fPriority);
+}
+
+//______________________________________________________________________________
+TNetXNGRateGuard::~TNetXNGRateGuard()
+{
+   // Release the grant
+
+   if (fHeld)
+      TNetXNGRateLimiter::Release(fHost.c_str(), fBytes, fPriority);
+}
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRequestQueue                                                        //
+//                                                                            //
+// Internal helper sending asynchronous requests with a bounded number of     //
+// them in flight. Completed requests may queue follow-up requests, which     //
+// allows chains (e.g. stat then remove) to be pipelined.                     //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGRequestQueue.h"
+#include "TEnv.h"
+
+//______________________________________________________________________________
+void TNetXNGRequest::HandleResponse(XrdCl::XRootDStatus *status,
+                                    XrdCl::AnyObject    *response)
+{
+   // Called when a response to the request arrives or an error occurs
+
+   fQueue->Complete(this, status, response);
+}
+
+//______________________________________________________________________________
+TNetXNGRequestQueue::TNetXNGRequestQueue(Int_t window) :
+   fCond(0), fInFlight(0), fWindow(window),
+   fPriority(TNetXNGRateLimiter::kMetadata), fScheduled(kFALSE)
+{
+   // Constructor
+   //
+   // param window: max number of requests in flight, 0 for the value of
+   //               NetXNG.RequestWindow (default 64)
+
+   if (fWindow <= 0)
+      fWindow = gEnv->GetValue("NetXNG.RequestWindow", 64);
+   if (fWindow <= 0)
+      fWindow = 1;
+}
+
+//______________________________________________________________________________
+TNetXNGRequestQueue::~TNetXNGRequestQueue()
+{
+   // Destructor. Requests which were never sent are dropped.
+
+   while (!fPending.empty()) {
+      delete fPending.front();
+      fPending.pop_front();
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGRequestQueue::Schedule(const std::string &host,
+                                   TNetXNGRateLimiter::EPriority priority)
+{
+   // Have every request wait for a grant of TNetXNGRateLimiter before it is
+   // sent, on top of the window. Must be called before Run().
+   //
+   // param host:     the server (host:port) the requests go to
+   // param priority: the class of the requests, not kPrefetch
+
+   fHost      = host;
+   fPriority  = priority;
+   fScheduled = kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGRequestQueue::Push(TNetXNGRequest *request)
+{
+   // Queue a request, which is then owned by the queue. May be called from
+   // TNetXNGRequest::Done() to chain requests.
+
+   request->fQueue = this;
+   XrdSysCondVarHelper lock(fCond);
+   fPending.push_back(request);
+   fCond.Broadcast();
+}
+
+//______________________________________________________________________________
+void TNetXNGRequestQueue::Run()
+{
+   // Send the queued requests, keeping at most fWindow of them in flight,
+   // until all of them and their follow-ups are done. The grants of the
+   // rate limiter, if any, are waited for here, never in the threads
+   // completing the requests.
+
+   fCond.Lock();
+   while (true) {
+      while (!fPending.empty() && fInFlight < fWindow) {
+         TNetXNGRequest *request = fPending.front();
+         fPending.pop_front();
+         ++fInFlight;
+         fCond.UnLock();
+
+         if (fScheduled && TNetXNGRateLimiter::IsEnabled())
+            request->fHeld = TNetXNGRateLimiter::Acquire(fHost.c_str(), 0,
+                                                         fPriority);
+         XrdCl::XRootDStatus st = request->Send();
+         if (!st.IsOK())
+            Complete(request, new XrdCl::XRootDStatus(st), 0);
+
+         fCond.Lock();
+      }
+
+      if (fPending.empty() && !fInFlight)
+         break;
+      fCond.Wait();
+   }
+   fCond.UnLock();
+}
+
+//______________________________________________________________________________
+void TNetXNGRequestQueue::Complete(TNetXNGRequest      *request,
+                                   XrdCl::XRootDStatus *status,
+                                   XrdCl::AnyObject    *response)
+{
+   // Hand the outcome of a request over to it, then release its slot. The
+   // follow-ups are queued before the slot is released, so that Run() never
+   // sees an empty queue in between.
+
+   request->Done(status, response);
+   if (request->fHeld)
+      TNetXNGRateLimiter::Release(fHost.c_str(), 0, fPriority);
+   delete status;
+   delete response;
+   delete request;
+
+   XrdSysCondVarHelper lock(fCond);
+   --fInFlight;
+   fCond.Broadcast();
+}
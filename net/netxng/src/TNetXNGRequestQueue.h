@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+#ifndef ROOT_TNetXNGRequestQueue
+#define ROOT_TNetXNGRequestQueue
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGRequestQueue                                                        //
+//                                                                            //
+// Internal helper sending asynchronous requests with a bounded number of     //
+// them in flight. Completed requests may queue follow-up requests, which     //
+// allows chains (e.g. stat then remove) to be pipelined.                     //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include "TNetXNGRateLimiter.h"
+#include <XrdSys/XrdSysPthread.hh>
+#include <XrdCl/XrdClXRootDResponses.hh>
+#include <deque>
+#include <string>
+
+class TNetXNGRequestQueue;
+
+class TNetXNGRequest: public XrdCl::ResponseHandler {
+   friend class TNetXNGRequestQueue;
+
+private:
+   TNetXNGRequestQueue *fQueue; // Queue this request belongs to
+   Bool_t               fHeld;  // A grant of the rate limiter is held
+
+public:
+   TNetXNGRequest() : fQueue(0), fHeld(kFALSE) {}
+   virtual ~TNetXNGRequest() {}
+
+   // Send the request asynchronously, with this object as handler
+   virtual XrdCl::XRootDStatus Send() = 0;
+
+   // Process the response; the status and response are deleted afterwards
+   virtual void Done(XrdCl::XRootDStatus *status,
+                     XrdCl::AnyObject    *response) = 0;
+
+   virtual void HandleResponse(XrdCl::XRootDStatus *status,
+                               XrdCl::AnyObject    *response);
+
+protected:
+   TNetXNGRequestQueue *GetQueue() const { return fQueue; }
+};
+
+class TNetXNGRequestQueue {
+private:
+   XrdSysCondVar                fCond;     // Protects the members below
+   std::deque<TNetXNGRequest *> fPending;  // Requests not sent yet
+   Int_t                        fInFlight; // Requests sent and not done
+   Int_t                        fWindow;   // Max requests in flight
+   std::string                  fHost;     // Server, for the rate limiter
+   TNetXNGRateLimiter::EPriority
+                                fPriority; // Class of the requests
+   Bool_t                       fScheduled; // Go through the rate limiter
+
+public:
+   TNetXNGRequestQueue(Int_t window = 0);
+   ~TNetXNGRequestQueue();
+
+   void  Schedule(const std::string &host,
+                  TNetXNGRateLimiter::EPriority priority);
+   void  Push(TNetXNGRequest *request);
+   void  Run();
+   Int_t GetWindow() const { return fWindow; }
+
+private:
+   void  Complete(TNetXNGRequest *request, XrdCl::XRootDStatus *status,
+                  XrdCl::AnyObject *response);
+
+   TNetXNGRequestQueue(const TNetXNGRequestQueue &other);             // Not implemented
+   TNetXNGRequestQueue &operator =(const TNetXNGRequestQueue &other); // Not implemented
+
+   friend class TNetXNGRequest;
+};
+
+#endif // ROOT_TNetXNGRequestQueue
@@ -0,0 +1,308 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGStaging                                                             //
+//                                                                            //
+// Tracks an asynchronous staging request issued by TNetXNGSystem, so that    //
+// files can be processed as soon as they come online.                        //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGStaging.h"
+#include "TNetXNGRequestQueue.h"
+#include "TFileStager.h"
+#include "TCollection.h"
+#include "TSystem.h"
+#include "TError.h"
+#include "TEnv.h"
+#include "TMath.h"
+#include <XrdCl/XrdClFileSystem.hh>
+#include <XrdCl/XrdClXRootDResponses.hh>
+#include <ctime>
+
+namespace {
+
+   //___________________________________________________________________________
+   // Prepare request for a batch of files
+   class TNetXNGPrepareRequest: public TNetXNGRequest {
+   private:
+      TNetXNGStaging           *fStaging;
+      XrdCl::FileSystem        *fFileSystem;
+      std::vector<std::string>  fPaths;
+      Int_t                     fFirst;    // Index of the first file
+      UChar_t                   fPriority;
+
+   public:
+      TNetXNGPrepareRequest(TNetXNGStaging *staging, XrdCl::FileSystem *fs,
+                            Int_t first, UChar_t priority) :
+         fStaging(staging), fFileSystem(fs), fFirst(first),
+         fPriority(priority) {}
+
+      void Add(const std::string &path) { fPaths.push_back(path); }
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         using namespace XrdCl;
+         return fFileSystem->Prepare(fPaths, PrepareFlags::Stage,
+                                     (uint8_t) fPriority, this);
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status,
+                        XrdCl::AnyObject    *response)
+      {
+         using namespace XrdCl;
+
+         if (!status->IsOK()) {
+            ::Error("TNetXNGStaging::Prepare", "%s",
+                    status->GetErrorMessage().c_str());
+            for (UInt_t i = 0; i < fPaths.size(); ++i)
+               fStaging->SetState(fFirst + i, TNetXNGStaging::kFailed,
+                                  status->GetErrorMessage());
+            return;
+         }
+
+         // The response holds the request id, possibly null terminated
+         Buffer *buffer = 0;
+         response->Get(buffer);
+         std::string id = buffer ? std::string(buffer->GetBuffer(),
+                                               buffer->GetSize()) : "";
+         id = id.substr(0, id.find_first_of(std::string("\n\0", 2)));
+         fStaging->AddRequestId(id);
+      }
+   };
+
+   //___________________________________________________________________________
+   // Stat request checking whether a file is online
+   class TNetXNGStageStatRequest: public TNetXNGRequest {
+   private:
+      TNetXNGStaging    *fStaging;
+      XrdCl::FileSystem *fFileSystem;
+      Int_t              fIndex;
+
+   public:
+      TNetXNGStageStatRequest(TNetXNGStaging *staging, XrdCl::FileSystem *fs,
+                              Int_t index) :
+         fStaging(staging), fFileSystem(fs), fIndex(index) {}
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         return fFileSystem->Stat(fStaging->GetPath(fIndex), this);
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status,
+                        XrdCl::AnyObject    *response)
+      {
+         using namespace XrdCl;
+
+         if (!status->IsOK()) {
+            fStaging->SetState(fIndex, TNetXNGStaging::kFailed,
+                               status->GetErrorMessage());
+            return;
+         }
+
+         StatInfo *info = 0;
+         response->Get(info);
+         if (info && !info->TestFlags(StatInfo::Offline))
+            fStaging->SetState(fIndex, TNetXNGStaging::kOnline, "");
+      }
+   };
+}
+
+//______________________________________________________________________________
+TNetXNGStaging::TNetXNGStaging(const char *url, TNetXNGStageMonitor *monitor,
+                               Int_t window) :
+   fMonitor(monitor), fWindow(window), fNOnline(0), fNFailed(0)
+{
+   // Constructor
+   //
+   // param url:     URL of the entry-point server
+   // param monitor: receives the state changes of the files, may be 0
+   // param window:  max number of requests in flight, 0 for the default
+   //                (NetXNG.RequestWindow)
+
+   using namespace XrdCl;
+   fFileSystem = new FileSystem(URL(std::string(url)));
+}
+
+//______________________________________________________________________________
+TNetXNGStaging::~TNetXNGStaging()
+{
+   // Destructor
+
+   delete fFileSystem;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGStaging::Prepare(TCollection *files, UChar_t priority,
+                              Int_t batchSize)
+{
+   // Issue the stage requests for a list of files. The list is split into
+   // batches, which are sent concurrently; the request id of each batch is
+   // kept.
+   //
+   // param files:     list of files to stage
+   // param priority:  staging priority
+   // param batchSize: max number of files per prepare request, 0 for the
+   //                  value of NetXNG.StageBatchSize (default 1000)
+   // returns:         0 for success, -1 if any batch failed
+
+   using namespace XrdCl;
+
+   if (batchSize <= 0)
+      batchSize = TMath::Max(1, gEnv->GetValue("NetXNG.StageBatchSize", 1000));
+
+   TNetXNGRequestQueue    queue(fWindow);
+   TNetXNGPrepareRequest *batch = 0;
+   Int_t                  nbatch = 0;
+
+   TIter it(files);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         ::Warning("TNetXNGStaging::Prepare",
+                   "object is of unexpected type %s - ignoring",
+                   object->ClassName());
+         continue;
+      }
+
+      if (!batch || nbatch == batchSize) {
+         if (batch) queue.Push(batch);
+         batch  = new TNetXNGPrepareRequest(this, fFileSystem, fPaths.size(),
+                                            priority);
+         nbatch = 0;
+      }
+
+      std::string p = URL(path.Data()).GetPath();
+      fPaths.push_back(p);
+      fStates.push_back(kPending);
+      fErrors.push_back("");
+      batch->Add(p);
+      ++nbatch;
+   }
+   if (batch) queue.Push(batch);
+
+   Int_t nfailed = fNFailed;
+   queue.Run();
+   return (fNFailed > nfailed) ? -1 : 0;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGStaging::Poll()
+{
+   // Check once which of the pending files are now online, notifying the
+   // monitor of each change. The files are stat'ed concurrently.
+   //
+   // returns: the number of files still pending
+
+   std::vector<Int_t> pending;
+   for (UInt_t i = 0; i < fStates.size(); ++i)
+      if (fStates[i] == kPending) pending.push_back(i);
+
+   TNetXNGRequestQueue queue(fWindow);
+   for (UInt_t i = 0; i < pending.size(); ++i)
+      queue.Push(new TNetXNGStageStatRequest(this, fFileSystem, pending[i]));
+   queue.Run();
+
+   if (fMonitor) {
+      for (UInt_t i = 0; i < pending.size(); ++i) {
+         Int_t j = pending[i];
+         if (fStates[j] == kOnline)
+            fMonitor->Online(fPaths[j].c_str());
+         else if (fStates[j] == kFailed)
+            fMonitor->Failed(fPaths[j].c_str(), fErrors[j].c_str());
+      }
+   }
+
+   return GetNPending();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGStaging::Wait(Int_t timeout, Int_t interval)
+{
+   // Poll until no file is pending anymore
+   //
+   // param timeout:  max time to wait in seconds, < 0 for no limit
+   // param interval: time between two polls in seconds
+   // returns:        kTRUE if no file is pending, kFALSE on timeout
+
+   time_t start = time(0);
+   while (Poll() > 0) {
+      if (timeout >= 0 && time(0) - start + interval > timeout)
+         return kFALSE;
+      gSystem->Sleep(TMath::Max(interval, 1) * 1000);
+   }
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGStaging::GetNFiles() const
+{
+   // Get the number of files of the request
+
+   return fPaths.size();
+}
+
+//______________________________________________________________________________
+const char *TNetXNGStaging::GetPath(Int_t i) const
+{
+   // Get the path of the i-th file
+
+   return (i >= 0 && i < GetNFiles()) ? fPaths[i].c_str() : 0;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGStaging::GetState(Int_t i) const
+{
+   // Get the EFileState of the i-th file
+
+   return (i >= 0 && i < GetNFiles()) ? fStates[i] : kFailed;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGStaging::GetNRequests() const
+{
+   // Get the number of prepare requests accepted by the server
+
+   return fRequestIds.size();
+}
+
+//______________________________________________________________________________
+const char *TNetXNGStaging::GetRequestId(Int_t i) const
+{
+   // Get the id assigned by the server to the i-th prepare request
+
+   return (i >= 0 && i < GetNRequests()) ? fRequestIds[i].c_str() : 0;
+}
+
+//______________________________________________________________________________
+void TNetXNGStaging::SetState(Int_t i, EFileState state,
+                              const std::string &error)
+{
+   // Change the state of a pending file. Called from the response handlers.
+
+   XrdSysMutexHelper lock(fMutex);
+   if (fStates[i] != kPending)
+      return;
+
+   fStates[i] = state;
+   fErrors[i] = error;
+   if (state == kOnline) ++fNOnline;
+   if (state == kFailed) ++fNFailed;
+}
+
+//______________________________________________________________________________
+void TNetXNGStaging::AddRequestId(const std::string &id)
+{
+   // Record the id of a prepare request. Called from the response handlers.
+
+   XrdSysMutexHelper lock(fMutex);
+   fRequestIds.push_back(id);
+}
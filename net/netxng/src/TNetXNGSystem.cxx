@@ -18,15 +18,440 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "TNetXNGSystem.h"
+#include "TNetXNGRequestQueue.h"
+#include "TNetXNGStaging.h"
+#include "TNetXNGTrace.h"
+#include "TNetXNGRateLimiter.h"
+#include "TNetXNGRace.h"
 #include "TFileStager.h"
 #include "Rtypes.h"
 #include "TList.h"
 #include "TUrl.h"
+#include "TMath.h"
+#include "TEnv.h"
+#include "TError.h"
 #include <XrdCl/XrdClFileSystem.hh>
 #include <XrdCl/XrdClXRootDResponses.hh>
+#include <XrdCl/XrdClCopyProcess.hh>
+#include <XrdSys/XrdSysPthread.hh>
+#include <set>
+#include <vector>
 
 ClassImp( TNetXNGSystem);
 
+namespace {
+
+   //___________________________________________________________________________
+   // Locate of a file through several equivalent entry points at the same
+   // time (see TNetXNGRace)
+   class TNetXNGLocateRace: public TNetXNGRace {
+   private:
+      std::vector<XrdCl::FileSystem *> fFileSystems; // One per entry point
+      std::string                      fPath;        // File to locate
+
+   public:
+      TNetXNGLocateRace(const std::vector<std::string> &hosts,
+                        const std::string &path) :
+         TNetXNGRace(hosts), fPath(path)
+      {
+         for (UInt_t i = 0; i < hosts.size(); ++i)
+            fFileSystems.push_back(new XrdCl::FileSystem(
+               XrdCl::URL(std::string("root://") + hosts[i] + "/")));
+      }
+
+   protected:
+      virtual ~TNetXNGLocateRace()
+      {
+         for (UInt_t i = 0; i < fFileSystems.size(); ++i)
+            delete fFileSystems[i];
+      }
+
+      virtual XrdCl::XRootDStatus Send(Int_t i,
+                                       XrdCl::ResponseHandler *handler)
+      {
+         return fFileSystems[i]->Locate(fPath, XrdCl::OpenFlags::None,
+                                        handler);
+      }
+   };
+
+   //___________________________________________________________________________
+   // Jobs of a third-party copy, shared by the threads running them
+   struct TNetXNGCopyQueue {
+      std::vector<std::string> fSources;      // Source URLs
+      std::vector<std::string> fDestinations; // Destination URLs
+      UInt_t                   fNext;         // Next job to be started
+      Int_t                    fFailed;       // Number of failed jobs
+      Bool_t                   fForce;        // Overwrite destinations
+      TNetXNGCopyMonitor      *fMonitor;      // User monitor, may be 0
+      XrdSysMutex              fMutex;        // Protects all of the above
+
+      TNetXNGCopyQueue() : fNext(0), fFailed(0), fForce(kFALSE), fMonitor(0) {}
+   };
+
+   //___________________________________________________________________________
+   // Forwards the progress of one job to the user monitor
+   class TNetXNGCopyProgress: public XrdCl::CopyProgressHandler {
+   private:
+      TNetXNGCopyQueue *fQueue;
+      Int_t             fJob;
+
+   public:
+      TNetXNGCopyProgress(TNetXNGCopyQueue *queue, Int_t job) :
+         fQueue(queue), fJob(job) {}
+
+      virtual void BeginJob(uint16_t, uint16_t, const XrdCl::URL *source,
+                            const XrdCl::URL *destination)
+      {
+         XrdSysMutexHelper lock(fQueue->fMutex);
+         if (fQueue->fMonitor)
+            fQueue->fMonitor->Begin(fJob, source->GetURL().c_str(),
+                                    destination->GetURL().c_str());
+      }
+
+      virtual void JobProgress(uint64_t bytesProcessed, uint64_t bytesTotal)
+      {
+         XrdSysMutexHelper lock(fQueue->fMutex);
+         if (fQueue->fMonitor)
+            fQueue->fMonitor->Progress(fJob, bytesProcessed, bytesTotal);
+      }
+
+      virtual bool ShouldCancel()
+      {
+         XrdSysMutexHelper lock(fQueue->fMutex);
+         return fQueue->fMonitor && fQueue->fMonitor->ShouldCancel(fJob);
+      }
+   };
+
+   //___________________________________________________________________________
+   // A path being removed by a bulk unlink. Directories are removed once
+   // all of their entries are.
+   struct TNetXNGUnlinkNode {
+      std::string        fPath;    // Path on the server
+      TNetXNGUnlinkNode *fParent;  // Enclosing directory, 0 at top level
+      Int_t              fPending; // Entries not removed yet
+      Bool_t             fFailed;  // An entry could not be removed
+
+      TNetXNGUnlinkNode(const std::string &path, TNetXNGUnlinkNode *parent) :
+         fPath(path), fParent(parent), fPending(0), fFailed(kFALSE) {}
+   };
+
+   //___________________________________________________________________________
+   // State shared by the requests of a bulk unlink
+   struct TNetXNGUnlinkJob {
+      XrdCl::FileSystem               *fFileSystem; // Where to send requests
+      Bool_t                           fRecursive;  // Descend directories
+      Int_t                            fFailed;     // Top level failures
+      std::vector<TNetXNGUnlinkNode *> fNodes;      // All nodes, owned
+      XrdSysMutex                      fMutex;      // Protects the nodes
+
+      TNetXNGUnlinkJob() : fFileSystem(0), fRecursive(kFALSE), fFailed(0) {}
+      ~TNetXNGUnlinkJob()
+      {
+         for (UInt_t i = 0; i < fNodes.size(); ++i) delete fNodes[i];
+      }
+
+      TNetXNGUnlinkNode *AddNode(const std::string &path,
+                                 TNetXNGUnlinkNode *parent)
+      {
+         XrdSysMutexHelper lock(fMutex);
+         fNodes.push_back(new TNetXNGUnlinkNode(path, parent));
+         return fNodes.back();
+      }
+   };
+
+   //___________________________________________________________________________
+   // One step of the removal of a path
+   class TNetXNGUnlinkRequest: public TNetXNGRequest {
+   public:
+      enum EOp { kStat, kList, kRm, kRmDir };
+
+   private:
+      TNetXNGUnlinkJob  *fJob;
+      TNetXNGUnlinkNode *fNode;
+      EOp                fOp;
+
+   public:
+      TNetXNGUnlinkRequest(TNetXNGUnlinkJob *job, TNetXNGUnlinkNode *node,
+                           EOp op) : fJob(job), fNode(node), fOp(op) {}
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         using namespace XrdCl;
+         FileSystem *fs = fJob->fFileSystem;
+         switch (fOp) {
+            case kStat:  return fs->Stat(fNode->fPath, this);
+            case kList:  return fs->DirList(fNode->fPath,
+                                   DirListFlags::Flags(DirListFlags::Stat |
+                                                       DirListFlags::Locate),
+                                   this);
+            case kRm:    return fs->Rm(fNode->fPath, this);
+            default:     return fs->RmDir(fNode->fPath, this);
+         }
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status,
+                        XrdCl::AnyObject    *response)
+      {
+         using namespace XrdCl;
+
+         if (!status->IsOK()) {
+            ::Error("TNetXNGSystem::UnlinkAll", "%s: %s",
+                    fNode->fPath.c_str(), status->GetErrorMessage().c_str());
+            Finish(fNode, kFALSE);
+            return;
+         }
+
+         if (fOp == kStat) {
+            StatInfo *info = 0;
+            response->Get(info);
+            if (!info->TestFlags(StatInfo::IsDir))
+               Next(fNode, kRm);
+            else
+               Next(fNode, fJob->fRecursive ? kList : kRmDir);
+         } else if (fOp == kList) {
+            DirectoryList *list = 0;
+            response->Get(list);
+            Expand(list);
+         } else {
+            Finish(fNode, kTRUE);
+         }
+      }
+
+   private:
+      void Next(TNetXNGUnlinkNode *node, EOp op)
+      {
+         GetQueue()->Push(new TNetXNGUnlinkRequest(fJob, node, op));
+      }
+
+      void Expand(XrdCl::DirectoryList *list)
+      {
+         // Queue the removal of all the entries of a directory, or the
+         // directory itself if it is empty
+
+         using namespace XrdCl;
+         std::vector<std::pair<TNetXNGUnlinkNode *, EOp> > next;
+
+         for (DirectoryList::Iterator it = list->Begin(); it != list->End();
+              ++it) {
+            const std::string &name = (*it)->GetName();
+            if (name == "." || name == "..")
+               continue;
+
+            TNetXNGUnlinkNode *child = fJob->AddNode(fNode->fPath + "/" + name,
+                                                     fNode);
+            StatInfo *info = (*it)->GetStatInfo();
+            EOp op = !info ? kStat :
+                     info->TestFlags(StatInfo::IsDir) ? kList : kRm;
+            next.push_back(std::make_pair(child, op));
+         }
+
+         {
+            XrdSysMutexHelper lock(fJob->fMutex);
+            fNode->fPending = next.size();
+         }
+
+         if (next.empty())
+            Next(fNode, kRmDir);
+         for (UInt_t i = 0; i < next.size(); ++i)
+            Next(next[i].first, next[i].second);
+      }
+
+      void Finish(TNetXNGUnlinkNode *node, Bool_t ok)
+      {
+         // Record the outcome for a path; a directory whose last entry was
+         // just removed gets removed in turn
+
+         while (node) {
+            TNetXNGUnlinkNode *parent = node->fParent;
+            XrdSysMutexHelper lock(fJob->fMutex);
+
+            if (!parent) {
+               if (!ok) ++fJob->fFailed;
+               return;
+            }
+
+            if (!ok) parent->fFailed = kTRUE;
+            if (--parent->fPending > 0)
+               return;
+
+            if (!parent->fFailed) {
+               lock.UnLock();
+               Next(parent, kRmDir);
+               return;
+            }
+
+            // Cannot remove a directory whose entries are still there
+            node = parent;
+            ok   = kFALSE;
+         }
+      }
+   };
+
+   //___________________________________________________________________________
+   // Creation of a directory, including its missing parents
+   class TNetXNGMkDirRequest: public TNetXNGRequest {
+   private:
+      XrdCl::FileSystem *fFileSystem;
+      std::string        fPath;
+      Int_t             *fFailed;
+      XrdSysMutex       *fMutex;
+
+   public:
+      TNetXNGMkDirRequest(XrdCl::FileSystem *fs, const std::string &path,
+                          Int_t *failed, XrdSysMutex *mutex) :
+         fFileSystem(fs), fPath(path), fFailed(failed), fMutex(mutex) {}
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         using namespace XrdCl;
+         return fFileSystem->MkDir(fPath, MkDirFlags::MakePath, Access::None,
+                                   this);
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status, XrdCl::AnyObject *)
+      {
+         if (status->IsOK())
+            return;
+
+         ::Error("TNetXNGSystem::MakeDirectories", "%s: %s", fPath.c_str(),
+                 status->GetErrorMessage().c_str());
+         XrdSysMutexHelper lock(fMutex);
+         ++*fFailed;
+      }
+   };
+
+   //___________________________________________________________________________
+   // Ping of a server, which has XrdCl connect and authenticate to it. The
+   // channel stays open once the request is done, for the later requests.
+   class TNetXNGPingRequest: public TNetXNGRequest {
+   private:
+      XrdCl::FileSystem *fFileSystem; // Owned
+      std::string        fHost;
+      Int_t             *fFailed;
+      XrdSysMutex       *fMutex;
+
+   public:
+      TNetXNGPingRequest(const std::string &host, Int_t *failed,
+                         XrdSysMutex *mutex) :
+         fFileSystem(new XrdCl::FileSystem(
+            XrdCl::URL(std::string("root://") + host + "/"))),
+         fHost(host), fFailed(failed), fMutex(mutex) {}
+
+      virtual ~TNetXNGPingRequest() { delete fFileSystem; }
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         return fFileSystem->Ping(this);
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status, XrdCl::AnyObject *)
+      {
+         if (status->IsOK())
+            return;
+
+         if (gDebug > 0)
+            ::Info("TNetXNGSystem::Prewarm", "%s: %s", fHost.c_str(),
+                   status->GetErrorMessage().c_str());
+         XrdSysMutexHelper lock(fMutex);
+         ++*fFailed;
+      }
+   };
+
+   //___________________________________________________________________________
+   // Checksum query for one path of a bulk request
+   class TNetXNGChecksumRequest: public TNetXNGRequest {
+   private:
+      XrdCl::FileSystem *fFileSystem;
+      std::string        fPath;
+      TNamed            *fResult;  // Receives "<type> <value>" as title
+      Int_t             *fFailed;
+      XrdSysMutex       *fMutex;
+
+   public:
+      TNetXNGChecksumRequest(XrdCl::FileSystem *fs, const std::string &path,
+                             TNamed *result, Int_t *failed,
+                             XrdSysMutex *mutex) :
+         fFileSystem(fs), fPath(path), fResult(result), fFailed(failed),
+         fMutex(mutex) {}
+
+      virtual XrdCl::XRootDStatus Send()
+      {
+         using namespace XrdCl;
+         Buffer arg;
+         arg.FromString(fPath);
+         return fFileSystem->Query(QueryCode::Checksum, arg, this);
+      }
+
+      virtual void Done(XrdCl::XRootDStatus *status,
+                        XrdCl::AnyObject    *response)
+      {
+         using namespace XrdCl;
+
+         TString type, value;
+         Buffer *buffer = 0;
+         if (status->IsOK()) response->Get(buffer);
+         if (buffer && TNetXNGSystem::ParseChecksum(buffer->ToString().c_str(),
+                                                    type, value)) {
+            fResult->SetTitle(type + " " + value);
+            return;
+         }
+
+         ::Error("TNetXNGSystem::GetChecksums", "%s: %s", fPath.c_str(),
+                 status->IsOK() ? "invalid response"
+                                : status->GetErrorMessage().c_str());
+         XrdSysMutexHelper lock(fMutex);
+         ++*fFailed;
+      }
+   };
+
+   //___________________________________________________________________________
+   void *RunCopyJobs(void *arg)
+   {
+      // Run third-party copy jobs until the queue is empty
+
+      using namespace XrdCl;
+      TNetXNGCopyQueue *queue = (TNetXNGCopyQueue *) arg;
+
+      while (true) {
+         queue->fMutex.Lock();
+         if (queue->fNext >= queue->fSources.size()) {
+            queue->fMutex.UnLock();
+            return 0;
+         }
+         Int_t job = queue->fNext++;
+         queue->fMutex.UnLock();
+
+         // The data must flow between the servers only: no fallback to a
+         // copy through this client
+         JobDescriptor desc;
+         desc.source             = URL(queue->fSources[job]);
+         desc.target             = URL(queue->fDestinations[job]);
+         desc.force              = queue->fForce;
+         desc.thirdParty         = true;
+         desc.thirdPartyFallBack = false;
+
+         CopyProcess         process;
+         TNetXNGCopyProgress progress(queue, job);
+         XRootDStatus st = process.AddJob(&desc);
+         if (st.IsOK()) st = process.Prepare();
+         if (st.IsOK()) st = process.Run(&progress);
+         if (st.IsOK()) st = desc.status;
+
+         XrdSysMutexHelper lock(queue->fMutex);
+         if (!st.IsOK()) {
+            ++queue->fFailed;
+            ::Error("TNetXNGSystem::ThirdPartyCopy", "%s -> %s: %s",
+                    queue->fSources[job].c_str(),
+                    queue->fDestinations[job].c_str(),
+                    st.ToStr().c_str());
+         }
+         if (queue->fMonitor)
+            queue->fMonitor->End(job, st.IsOK(),
+                                 st.IsOK() ? "" : st.ToStr().c_str());
+      }
+   }
+}
+
 //______________________________________________________________________________
 TNetXNGSystem::TNetXNGSystem(Bool_t /*owner*/) :
    TSystem("-root", "Net file Helper System"),
@@ -56,6 +481,8 @@ TNetXNGSystem::TNetXNGSystem(const char *url, Bool_t /*owner*/) :
    SetName("root");
    fUrl        = new URL(std::string(url));
    fFileSystem = new FileSystem(fUrl->GetURL());
+   TNetXNGTrace::Configure();
+   TNetXNGRateLimiter::Configure();
 }
 
 //______________________________________________________________________________
@@ -95,8 +522,14 @@ Int_t TNetXNGSystem::MakeDirectory(const char *dir)
 
    using namespace XrdCl;
    URL url(dir);
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                          TNetXNGRateLimiter::kMetadata);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
    XRootDStatus st = fFileSystem->MkDir(url.GetPath(), MkDirFlags::MakePath,
                                         Access::None);
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kMkDir, t0, url.GetPath().c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
    if (!st.IsOK()) {
       Error("MakeDirectory", "%s", st.GetErrorMessage().c_str());
       return -1;
@@ -139,8 +572,15 @@ const char* TNetXNGSystem::GetDirEntry(void *dirp)
    }
 
    if (!fDirList) {
+      TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                             TNetXNGRateLimiter::kMetadata);
+      Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
       XRootDStatus st = fFileSystem->DirList(fUrl->GetPath(),
                                              DirListFlags::Locate, fDirList);
+      if (t0)
+         TNetXNGTrace::Record(TNetXNGTrace::kDirList, t0,
+                              fUrl->GetPath().c_str(),
+                              fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
       if (!st.IsOK()) {
          Error("GetDirEntry", "%s", st.GetErrorMessage().c_str());
          return 0;
@@ -167,7 +607,13 @@ Int_t TNetXNGSystem::GetPathInfo(const char *path, FileStat_t &buf)
    using namespace XrdCl;
    StatInfo *info = 0;
    URL target(path);
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                          TNetXNGRateLimiter::kMetadata);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
    XRootDStatus st = fFileSystem->Stat(target.GetPath(), info);
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kStat, t0, target.GetPath().c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
 
    if (!st.IsOK()) {
 
@@ -176,37 +622,47 @@ Int_t TNetXNGSystem::GetPathInfo(const char *path, FileStat_t &buf)
       return 1;
 
    } else {
-
-      // Flag offline files
-      if (info->GetFlags() & kXR_offline) {
-         buf.fMode = kS_IFOFF;
-      } else {
-         std::stringstream sstr(info->GetId());
-         Long64_t id;
-         sstr >> id;
-
-         buf.fDev    = (id >> 32);
-         buf.fIno    = (id & 0x00000000FFFFFFFF);
-         buf.fUid    = -1;  // not available
-         buf.fGid    = -1;  // not available
-         buf.fIsLink = 0;   // not available
-         buf.fSize   = info->GetSize();
-         buf.fMtime  = info->GetModTime();
-
-         if (info->GetFlags() & kXR_xset)
-            buf.fMode = (kS_IFREG | kS_IXUSR | kS_IXGRP | kS_IXOTH);
-         if (info->GetFlags() == 0)           buf.fMode = kS_IFREG;
-         if (info->GetFlags() & kXR_isDir)    buf.fMode = kS_IFDIR;
-         if (info->GetFlags() & kXR_other)    buf.fMode = kS_IFSOCK;
-         if (info->GetFlags() & kXR_readable) buf.fMode |= kS_IRUSR;
-         if (info->GetFlags() & kXR_writable) buf.fMode |= kS_IWUSR;
-      }
+      FillFileStat(info, buf);
    }
 
    delete info;
    return 0;
 }
 
+//______________________________________________________________________________
+void TNetXNGSystem::FillFileStat(const XrdCl::StatInfo *info, FileStat_t &buf)
+{
+   // Convert XRootD stat information to the ROOT representation
+   //
+   // param info: the stat information returned by the server (in)
+   // param buf:  structure that will hold the stat info (out)
+
+   // Flag offline files
+   if (info->GetFlags() & kXR_offline) {
+      buf.fMode = kS_IFOFF;
+   } else {
+      std::stringstream sstr(info->GetId());
+      Long64_t id;
+      sstr >> id;
+
+      buf.fDev    = (id >> 32);
+      buf.fIno    = (id & 0x00000000FFFFFFFF);
+      buf.fUid    = -1;  // not available
+      buf.fGid    = -1;  // not available
+      buf.fIsLink = 0;   // not available
+      buf.fSize   = info->GetSize();
+      buf.fMtime  = info->GetModTime();
+
+      if (info->GetFlags() & kXR_xset)
+         buf.fMode = (kS_IFREG | kS_IXUSR | kS_IXGRP | kS_IXOTH);
+      if (info->GetFlags() == 0)           buf.fMode = kS_IFREG;
+      if (info->GetFlags() & kXR_isDir)    buf.fMode = kS_IFDIR;
+      if (info->GetFlags() & kXR_other)    buf.fMode = kS_IFSOCK;
+      if (info->GetFlags() & kXR_readable) buf.fMode |= kS_IRUSR;
+      if (info->GetFlags() & kXR_writable) buf.fMode |= kS_IWUSR;
+   }
+}
+
 //______________________________________________________________________________
 Bool_t TNetXNGSystem::ConsistentWith(const char *path, void *dirptr)
 {
@@ -254,6 +710,9 @@ int TNetXNGSystem::Unlink(const char *path)
    URL url(path);
 
    // Stat the path to find out if it's a file or a directory
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                          TNetXNGRateLimiter::kMetadata);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
    XRootDStatus st = fFileSystem->Stat(url.GetPath(), info);
    if (!st.IsOK()) {
       Error("Unlink", "%s", st.GetErrorMessage().c_str());
@@ -266,6 +725,9 @@ int TNetXNGSystem::Unlink(const char *path)
    else
       st = fFileSystem->Rm(url.GetPath());
    delete info;
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kRemove, t0, url.GetPath().c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
 
    if (!st.IsOK()) {
       Error("Unlink", "%s", st.GetErrorMessage().c_str());
@@ -275,6 +737,146 @@ int TNetXNGSystem::Unlink(const char *path)
    return 0;
 }
 
+//______________________________________________________________________________
+Int_t TNetXNGSystem::UnlinkAll(TCollection *paths, Bool_t recursive,
+                               Int_t window)
+{
+   // Unlink many files or directories on the remote server. The stat and
+   // remove requests of all the paths are pipelined, with a bounded number
+   // of them in flight. In recursive mode, the entries of the directories
+   // are removed in parallel, bottom-up. The requests are metadata for
+   // TNetXNGRateLimiter.
+   //
+   // param paths:     list of paths to unlink
+   // param recursive: also remove the content of directories
+   // param window:    max number of requests in flight, 0 for the default
+   //                  (NetXNG.RequestWindow)
+   // returns:         the number of paths that could not be removed
+
+   using namespace XrdCl;
+
+   TNetXNGUnlinkJob    job;
+   TNetXNGRequestQueue queue(window);
+   queue.Schedule(fUrl->GetHostId(), TNetXNGRateLimiter::kMetadata);
+   job.fFileSystem = fFileSystem;
+   job.fRecursive  = recursive;
+
+   TIter it(paths);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         Warning("UnlinkAll", "object is of unexpected type %s - ignoring",
+                 object->ClassName());
+         continue;
+      }
+
+      TNetXNGUnlinkNode *node = job.AddNode(URL(path.Data()).GetPath(), 0);
+      queue.Push(new TNetXNGUnlinkRequest(&job, node,
+                                          TNetXNGUnlinkRequest::kStat));
+   }
+
+   queue.Run();
+   return job.fFailed;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGSystem::MakeDirectories(TCollection *dirs, Int_t window)
+{
+   // Create many directories, with a bounded number of requests in flight.
+   // Missing parent directories are created as well. The requests are
+   // metadata for TNetXNGRateLimiter.
+   //
+   // param dirs:   list of directory names
+   // param window: max number of requests in flight, 0 for the default
+   //               (NetXNG.RequestWindow)
+   // returns:      the number of directories that could not be created
+
+   using namespace XrdCl;
+
+   Int_t               failed = 0;
+   XrdSysMutex         mutex;
+   TNetXNGRequestQueue queue(window);
+   queue.Schedule(fUrl->GetHostId(), TNetXNGRateLimiter::kMetadata);
+
+   TIter it(dirs);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         Warning("MakeDirectories",
+                 "object is of unexpected type %s - ignoring",
+                 object->ClassName());
+         continue;
+      }
+
+      queue.Push(new TNetXNGMkDirRequest(fFileSystem,
+                                         URL(path.Data()).GetPath(),
+                                         &failed, &mutex));
+   }
+
+   queue.Run();
+   return failed;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGSystem::Prewarm(TCollection *urls, Int_t window)
+{
+   // Connect and authenticate to the servers of a list of files ahead of
+   // their use, in parallel, so that the first request to each of them
+   // does not pay for it (e.g. with the endpoints of a TFileCollection
+   // found by TNetXNGFileStager::LocateCollection). Each distinct server is
+   // pinged once; XrdCl keeps the connections for the later requests until
+   // they are idle for its TTL.
+   //
+   // XrdCl sets up the substreams of a connection when it is made. Servers
+   // for which substreams are configured (NetXNG.SubStreams.<host>,
+   // NetXNG.SubStreams or a NetXNG.Window over 4 MB, see
+   // TNetXNGFile::ConfigureTransport) are left to the open of their first
+   // file, which asks for them.
+   //
+   // param urls:   list of URLs of files, whose servers are connected to
+   // param window: max number of requests in flight, 0 for the default
+   //               (NetXNG.RequestWindow)
+   // returns:      the number of servers that could not be reached
+
+   using namespace XrdCl;
+
+   Bool_t wide = gEnv->GetValue("NetXNG.Window", 0) > 4194304 ||
+                 gEnv->GetValue("NetXNG.SubStreams", 0) > 0;
+
+   Int_t                 failed = 0;
+   XrdSysMutex           mutex;
+   TNetXNGRequestQueue   queue(window);
+   std::set<std::string> hosts;
+
+   TIter it(urls);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         Warning("Prewarm", "object is of unexpected type %s - ignoring",
+                 object->ClassName());
+         continue;
+      }
+
+      URL url(path.Data());
+      if (!url.IsValid() || (url.GetProtocol() != "root" &&
+                             url.GetProtocol() != "xroot"))
+         continue;
+      if (!hosts.insert(url.GetHostId()).second)
+         continue;
+      if (wide || gEnv->GetValue(Form("NetXNG.SubStreams.%s",
+                                      url.GetHostName().c_str()), 0) > 0)
+         continue;
+
+      queue.Push(new TNetXNGPingRequest(url.GetHostId(), &failed, &mutex));
+   }
+
+   queue.Run();
+   return failed;
+}
+
 //______________________________________________________________________________
 Bool_t TNetXNGSystem::IsPathLocal(const char *path)
 {
@@ -313,14 +915,44 @@ Int_t TNetXNGSystem::Locate(const char *path, TString &endurl)
    // param endurl: the endpoint URL of the file (out)
    // returns:      0 in case of success and 1 if the file could not be
    //               stat'ed.
+   //
+   // If the host of the system is one of the equivalent entry points
+   // listed in NetXNG.Redirectors, the locate is sent to the fastest ones
+   // at the same time and the first answer wins (see TNetXNGRace).
 
    using namespace XrdCl;
    LocationInfo *info = 0;
    URL pathUrl(path);
 
    // Locate the file
-   XRootDStatus st = fFileSystem->Locate(pathUrl.GetPath(), OpenFlags::None,
-                                         info);
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                          TNetXNGRateLimiter::kMetadata);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XRootDStatus st;
+   std::vector<std::string> hosts;
+   if (TNetXNGRace::GetEntryPoints(*fUrl, hosts) && hosts.size() > 1) {
+      TNetXNGLocateRace *race = new TNetXNGLocateRace(hosts,
+                                                      pathUrl.GetPath());
+      Int_t      winner   = -1;
+      AnyObject *response = 0;
+      st = race->Run(winner, response);
+      race->Release();
+      if (response) {
+         LocationInfo *located = 0;
+         response->Get(located);
+         if (located)
+            info = new LocationInfo(*located);
+         delete response;
+      }
+      if (st.IsOK() && !info)
+         st = XRootDStatus(stError, errInvalidResponse);
+   } else {
+      st = fFileSystem->Locate(pathUrl.GetPath(), OpenFlags::None, info);
+   }
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kLocate, t0,
+                           pathUrl.GetPath().c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
    if (!st.IsOK()) {
       Error("Locate", "%s", st.GetErrorMessage().c_str());
       delete info;
@@ -343,9 +975,10 @@ Int_t TNetXNGSystem::Stage(const char* path, UChar_t priority)
    //             opt = "option=o priority=p"
    // returns:    0 for success, -1 for error
 
-   TList *files = new TList();
-   files->Add((TObject *) new TUrl(path));
-   return Stage((TCollection *) files, priority);
+   TList files;
+   files.SetOwner();
+   files.Add((TObject *) new TUrl(path));
+   return Stage((TCollection *) &files, priority);
 }
 
 //______________________________________________________________________________
@@ -375,9 +1008,17 @@ Int_t TNetXNGSystem::Stage(TCollection *files, UChar_t priority)
       fileList.push_back(std::string(URL(path.Data()).GetPath()));
    }
 
-   Buffer *response;
+   Buffer *response = 0;
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0, TNetXNGRateLimiter::kBulk);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
    XRootDStatus st = fFileSystem->Prepare(fileList, PrepareFlags::Stage,
                                           (uint8_t) priority, response);
+   delete response;
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kPrepare, t0,
+                           fileList.empty() ? "" : fileList[0].c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0,
+                           fileList.size(), st.IsOK());
    if (!st.IsOK()) {
       Error("Stage", "%s", st.GetErrorMessage().c_str());
       return -1;
@@ -386,3 +1027,207 @@ Int_t TNetXNGSystem::Stage(TCollection *files, UChar_t priority)
    return 0;
 }
 
+//______________________________________________________________________________
+TNetXNGStaging *TNetXNGSystem::StageAsync(TCollection *files, UChar_t priority,
+                                          TNetXNGStageMonitor *monitor,
+                                          Int_t batchSize)
+{
+   // Issue stage requests for multiple files and return without waiting
+   // for them to come online. Huge lists are split into several prepare
+   // requests, sent concurrently. The returned object, owned by the caller,
+   // keeps the request ids and can be polled or waited on; the monitor is
+   // told about each file coming online or failing.
+   //
+   // param files:     list of files to stage
+   // param priority:  staging priority
+   // param monitor:   receives the state changes of the files, may be 0
+   // param batchSize: max number of files per prepare request, 0 for the
+   //                  value of NetXNG.StageBatchSize (default 1000)
+   // returns:         the staging request, or 0 if no batch was accepted
+
+   TNetXNGStaging *staging = new TNetXNGStaging(fUrl->GetURL().c_str(),
+                                                monitor);
+   if (staging->Prepare(files, priority, batchSize) &&
+       !staging->GetNRequests()) {
+      Error("StageAsync", "no stage request could be issued");
+      delete staging;
+      return 0;
+   }
+
+   return staging;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGSystem::GetChecksum(const char *path, TString &type,
+                                 TString &value)
+{
+   // Get the checksum of a file as computed by the server, which avoids
+   // reading the file back
+   //
+   // param path:  the path of the file
+   // param type:  the checksum algorithm, e.g. "adler32" (out)
+   // param value: the checksum value (out)
+   // returns:     0 on success, -1 otherwise
+
+   using namespace XrdCl;
+   Buffer arg;
+   Buffer *response = 0;
+   arg.FromString(URL(path).GetPath());
+
+   TNetXNGRateGuard guard(fUrl->GetHostId(), 0,
+                          TNetXNGRateLimiter::kMetadata);
+   Long64_t t0 = TNetXNGTrace::IsEnabled() ? TNetXNGTrace::Now() : 0;
+   XRootDStatus st = fFileSystem->Query(QueryCode::Checksum, arg, response);
+   if (t0)
+      TNetXNGTrace::Record(TNetXNGTrace::kQuery, t0,
+                           URL(path).GetPath().c_str(),
+                           fUrl->GetHostId().c_str(), -1, 0, 1, st.IsOK());
+   if (!st.IsOK()) {
+      Error("GetChecksum", "%s", st.GetErrorMessage().c_str());
+      delete response;
+      return -1;
+   }
+
+   Bool_t ok = ParseChecksum(response->ToString().c_str(), type, value);
+   delete response;
+   if (!ok) {
+      Error("GetChecksum", "invalid checksum response for %s", path);
+      return -1;
+   }
+
+   return 0;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGSystem::GetChecksums(TCollection *paths, TList *checksums,
+                                  Int_t window)
+{
+   // Get the checksums of many files, with a bounded number of queries in
+   // flight
+   //
+   // param paths:     list of paths
+   // param checksums: receives one TNamed per path, in the same order, named
+   //                  after the path and titled "<type> <value>"; the title
+   //                  is empty if the checksum could not be obtained. The
+   //                  objects are owned by the caller.
+   // param window:    max number of queries in flight, 0 for the default
+   //                  (NetXNG.RequestWindow)
+   // returns:         the number of checksums that could not be obtained
+
+   using namespace XrdCl;
+
+   if (!checksums) {
+      Error("GetChecksums", "no output list given");
+      return -1;
+   }
+
+   Int_t               failed = 0;
+   XrdSysMutex         mutex;
+   TNetXNGRequestQueue queue(window);
+   queue.Schedule(fUrl->GetHostId(), TNetXNGRateLimiter::kMetadata);
+
+   TIter it(paths);
+   TObject *object = 0;
+   while ((object = it.Next())) {
+      TString path = TFileStager::GetPathName(object);
+      if (path == "") {
+         Warning("GetChecksums", "object is of unexpected type %s - ignoring",
+                 object->ClassName());
+         continue;
+      }
+
+      TNamed *result = new TNamed(path.Data(), "");
+      checksums->Add(result);
+      queue.Push(new TNetXNGChecksumRequest(fFileSystem,
+                                            URL(path.Data()).GetPath(),
+                                            result, &failed, &mutex));
+   }
+
+   queue.Run();
+   return failed;
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGSystem::ParseChecksum(const char *response, TString &type,
+                                    TString &value)
+{
+   // Parse the response to a checksum query, of the form "<type> <value>"
+   //
+   // param response: the response of the server
+   // param type:     the checksum algorithm (out)
+   // param value:    the checksum value (out)
+   // returns:        kFALSE if the response is malformed
+
+   TString answer(response);
+   Ssiz_t from = 0;
+   if (!answer.Tokenize(type, from, "[ \n]") ||
+       !answer.Tokenize(value, from, "[ \n]"))
+      return kFALSE;
+
+   return kTRUE;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGSystem::ThirdPartyCopy(TCollection *sources,
+                                    TCollection *destinations, Int_t parallel,
+                                    TNetXNGCopyMonitor *monitor, Bool_t force)
+{
+   // Copy files between XRootD servers, without the data passing through
+   // this client. Several copies run at the same time; each of them is
+   // reported to the monitor, if any.
+   //
+   // param sources:      list of source URLs
+   // param destinations: list of destination URLs, one per source
+   // param parallel:     max number of copies running at the same time
+   // param monitor:      receives the progress and outcome of each copy;
+   //                     copy i is the i-th pair of the lists
+   // param force:        overwrite existing destinations
+   // returns:            the number of failed copies, -1 if the input is
+   //                     invalid
+
+   if (!sources || !destinations ||
+       sources->GetEntries() != destinations->GetEntries()) {
+      Error("ThirdPartyCopy", "need as many destinations as sources");
+      return -1;
+   }
+
+   TNetXNGCopyQueue queue;
+   queue.fForce   = force;
+   queue.fMonitor = monitor;
+
+   TIter its(sources), itd(destinations);
+   TObject *src, *dst;
+   while ((src = its.Next()) && (dst = itd.Next())) {
+      TString srcPath = TFileStager::GetPathName(src);
+      TString dstPath = TFileStager::GetPathName(dst);
+      if (srcPath == "" || dstPath == "") {
+         Error("ThirdPartyCopy", "objects of unexpected type %s, %s",
+               src->ClassName(), dst->ClassName());
+         return -1;
+      }
+      queue.fSources.push_back(std::string(srcPath.Data()));
+      queue.fDestinations.push_back(std::string(dstPath.Data()));
+   }
+
+   Int_t nthreads = TMath::Max(1, TMath::Min(parallel,
+                                             (Int_t) queue.fSources.size()));
+   std::vector<pthread_t> threads;
+   for (Int_t i = 0; i < nthreads; ++i) {
+      pthread_t tid;
+      if (XrdSysThread::Run(&tid, RunCopyJobs, &queue, XRDSYSTHREAD_HOLD,
+                            "TNetXNGSystem copy")) {
+         Warning("ThirdPartyCopy", "cannot start a copy thread");
+         break;
+      }
+      threads.push_back(tid);
+   }
+
+   // Run here if no thread could be started at all
+   if (threads.empty())
+      RunCopyJobs(&queue);
+
+   for (UInt_t i = 0; i < threads.size(); ++i)
+      XrdSysThread::Join(threads[i], 0);
+
+   return queue.fFailed;
+}
@@ -0,0 +1,392 @@
+/*******************************************************************************
+ * Copyright (C) 1995-2013, Rene Brun and Fons Rademakers.                     *
+ * All rights reserved.                                                        *
+ *                                                                             *
+ * For the licensing terms see $ROOTSYS/LICENSE.                               *
+ * For the list of contributors see $ROOTSYS/README/CREDITS.                   *
+ ******************************************************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// TNetXNGTrace                                                               //
+//                                                                            //
+// Records the requests issued by TNetXNGFile and TNetXNGSystem in a ring     //
+// buffer (operation, file, data server, offset, size, chunks, duration) and  //
+// writes them in the Chrome trace event format, which chrome://tracing and   //
+// Perfetto display as a timeline. Disabled by default: NetXNG.Trace set to   //
+// the number of events to keep enables it, NetXNG.TraceFile names a file     //
+// the trace is written to at exit.                                           //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TNetXNGTrace.h"
+#include "TEnv.h"
+#include "TError.h"
+#include "TMath.h"
+#include <XrdSys/XrdSysPthread.hh>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+Bool_t TNetXNGTrace::fgEnabled = kFALSE;
+
+namespace {
+
+   // One recorded request; names are kept once in a table, and each event
+   // holds a reference to its two names
+   struct TNetXNGTraceEvent {
+      Long64_t fStart;    // Microseconds since the epoch
+      Long64_t fDuration; // Microseconds
+      Long64_t fOffset;   // Offset in the file, -1 if not applicable
+      Long64_t fSize;     // Bytes requested
+      Long64_t fThread;   // Thread issuing the request
+      Int_t    fFile;     // Index of the file name
+      Int_t    fServer;   // Index of the data server name
+      Int_t    fNChunks;  // Chunks of a vector read
+      UChar_t  fOp;       // TNetXNGTrace::EOperation
+      Bool_t   fOK;       // The request succeeded
+   };
+
+   const char *kOperationNames[TNetXNGTrace::kNOperations] = {
+      "open", "close", "stat", "read", "readv", "write", "sync", "locate",
+      "query", "prepare", "rm", "mkdir", "dirlist", "copy"
+   };
+
+   XrdSysMutex                    gTraceMutex;    // Protects what follows
+   std::vector<TNetXNGTraceEvent> gTraceEvents;   // The ring buffer
+   Long64_t                       gTraceNext = 0; // Events recorded so far
+   std::map<std::string, Int_t>   gTraceIds;      // Name table, by name
+   std::vector<std::string>       gTraceNames;    // Name table, by index
+   std::vector<Int_t>             gTraceRefs;     // References, by index
+   std::vector<Int_t>             gTraceFree;     // Indices to reuse
+   std::string                    gTraceFile;     // Written at exit
+
+   //___________________________________________________________________________
+   Int_t TraceId(const char *name)
+   {
+      // Index of a name in the table, with a reference taken for the
+      // caller, with the trace mutex held
+
+      std::string key(name ? name : "");
+      std::map<std::string, Int_t>::iterator it = gTraceIds.find(key);
+      if (it != gTraceIds.end()) {
+         ++gTraceRefs[it->second];
+         return it->second;
+      }
+
+      Int_t id;
+      if (gTraceFree.empty()) {
+         id = gTraceNames.size();
+         gTraceNames.push_back(key);
+         gTraceRefs.push_back(1);
+      } else {
+         id = gTraceFree.back();
+         gTraceFree.pop_back();
+         gTraceNames[id] = key;
+         gTraceRefs[id]  = 1;
+      }
+      gTraceIds[key] = id;
+      return id;
+   }
+
+   //___________________________________________________________________________
+   void ReleaseId(Int_t id)
+   {
+      // Drop a reference to a name, which is removed from the table with
+      // the last one, with the trace mutex held
+
+      if (id < 0 || id >= (Int_t) gTraceRefs.size() || --gTraceRefs[id] > 0)
+         return;
+      gTraceIds.erase(gTraceNames[id]);
+      std::string().swap(gTraceNames[id]);
+      gTraceFree.push_back(id);
+   }
+
+   //___________________________________________________________________________
+   void DropEvents()
+   {
+      // Forget the events held, with the trace mutex held
+
+      Long64_t size  = gTraceEvents.size();
+      Long64_t first = gTraceNext > size ? gTraceNext - size : 0;
+      for (Long64_t i = first; i < gTraceNext; ++i) {
+         ReleaseId(gTraceEvents[i % size].fFile);
+         ReleaseId(gTraceEvents[i % size].fServer);
+      }
+      gTraceNext = 0;
+   }
+
+   //___________________________________________________________________________
+   Long64_t ThreadId()
+   {
+      // Identifier of the calling thread
+
+#if defined(__linux__) && defined(SYS_gettid)
+      return syscall(SYS_gettid);
+#else
+      return (Long64_t) (ULong_t) pthread_self();
+#endif
+   }
+
+   //___________________________________________________________________________
+   void WriteJSONString(FILE *out, const std::string &s)
+   {
+      // Write a string quoted and escaped for JSON
+
+      fputc('"', out);
+      for (std::string::size_type i = 0; i < s.size(); ++i) {
+         unsigned char c = s[i];
+         if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+         else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+         else
+            fputc(c, out);
+      }
+      fputc('"', out);
+   }
+
+   //___________________________________________________________________________
+   void DumpAtExit()
+   {
+      // Write the trace to NetXNG.TraceFile
+
+      if (!gTraceFile.empty())
+         TNetXNGTrace::Dump(gTraceFile.c_str());
+   }
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Configure()
+{
+   // Apply the NetXNG.Trace and NetXNG.TraceFile settings, the first time
+   // only. Called when files and systems are created.
+
+   static Bool_t configured = kFALSE;
+   {
+      XrdSysMutexHelper lock(gTraceMutex);
+      if (configured)
+         return;
+      configured = kTRUE;
+   }
+
+   Int_t capacity = gEnv->GetValue("NetXNG.Trace", 0);
+   if (capacity <= 0)
+      return;
+
+   const char *file = gEnv->GetValue("NetXNG.TraceFile", "");
+   if (file && *file) {
+      XrdSysMutexHelper lock(gTraceMutex);
+      gTraceFile = file;
+      atexit(DumpAtExit);
+   }
+   Enable(capacity);
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Enable(Int_t capacity)
+{
+   // Start recording, discarding what was recorded before
+   //
+   // param capacity: number of events kept, the oldest being overwritten;
+   //                 0 for 65536
+
+   if (capacity <= 0)
+      capacity = 65536;
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   DropEvents();
+   gTraceEvents.assign(capacity, TNetXNGTraceEvent());
+   fgEnabled = kTRUE;
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Disable()
+{
+   // Stop recording; the events recorded so far are kept
+
+   fgEnabled = kFALSE;
+}
+
+//______________________________________________________________________________
+Long64_t TNetXNGTrace::Now()
+{
+   // Get the current time in microseconds, the unit of the trace
+
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+   return (Long64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Record(EOperation op, Long64_t start, const char *file,
+                          const char *server, Long64_t offset, Long64_t size,
+                          Int_t nchunks, Bool_t ok)
+{
+   // Record a request which just completed. The names are looked up in
+   // the name table, which costs a string copy: objects issuing many
+   // requests should use Intern() once and pass the ids instead.
+   //
+   // param op:      the kind of request
+   // param start:   when it was issued, as given by Now()
+   // param file:    the file or path it concerns
+   // param server:  the server it was sent to
+   // param offset:  offset in the file, -1 if not applicable
+   // param size:    number of bytes requested
+   // param nchunks: number of chunks of a vector read, 1 otherwise
+   // param ok:      whether it succeeded
+
+   if (!fgEnabled)
+      return;
+
+   Int_t fileId   = Intern(file);
+   Int_t serverId = Intern(server);
+   Record(op, start, fileId, serverId, offset, size, nchunks, ok);
+   ReleaseName(fileId);
+   ReleaseName(serverId);
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Record(EOperation op, Long64_t start, Int_t file,
+                          Int_t server, Long64_t offset, Long64_t size,
+                          Int_t nchunks, Bool_t ok)
+{
+   // Record a request which just completed, with names given by Intern():
+   // this costs one short lock and no allocation
+   //
+   // param op:      the kind of request
+   // param start:   when it was issued, as given by Now()
+   // param file:    id of the file or path it concerns
+   // param server:  id of the server it was sent to
+   // param offset:  offset in the file, -1 if not applicable
+   // param size:    number of bytes requested
+   // param nchunks: number of chunks of a vector read, 1 otherwise
+   // param ok:      whether it succeeded
+
+   if (!fgEnabled)
+      return;
+
+   Long64_t end    = Now();
+   Long64_t thread = ThreadId();
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   if (gTraceEvents.empty())
+      return;
+
+   // The event overwritten releases its names
+   Long64_t slot = gTraceNext % gTraceEvents.size();
+   TNetXNGTraceEvent &ev = gTraceEvents[slot];
+   if (gTraceNext++ >= (Long64_t) gTraceEvents.size()) {
+      ReleaseId(ev.fFile);
+      ReleaseId(ev.fServer);
+   }
+   ++gTraceRefs[file];
+   ++gTraceRefs[server];
+   ev.fStart    = start;
+   ev.fDuration = end - start;
+   ev.fOffset   = offset;
+   ev.fSize     = size;
+   ev.fThread   = thread;
+   ev.fFile     = file;
+   ev.fServer   = server;
+   ev.fNChunks  = nchunks;
+   ev.fOp       = op;
+   ev.fOK       = ok;
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGTrace::Intern(const char *name)
+{
+   // Get the id of a name, for Record(). Names are kept while an id is held
+   // or an event refers to them, so that the table does not grow beyond
+   // the names of the events held and of the objects being traced.
+   //
+   // param name: the name
+   // returns:    its id, to be given back with ReleaseName()
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   return TraceId(name);
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::ReleaseName(Int_t id)
+{
+   // Give back an id obtained with Intern()
+   //
+   // param id: the id, nothing is done if negative
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   ReleaseId(id);
+}
+
+//______________________________________________________________________________
+Int_t TNetXNGTrace::GetNEvents()
+{
+   // Get the number of events held
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   return (Int_t) TMath::Min(gTraceNext, (Long64_t) gTraceEvents.size());
+}
+
+//______________________________________________________________________________
+void TNetXNGTrace::Clear()
+{
+   // Drop the recorded events
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   DropEvents();
+}
+
+//______________________________________________________________________________
+Bool_t TNetXNGTrace::Dump(const char *path)
+{
+   // Write the recorded events, oldest first, as a Chrome trace (JSON
+   // object format): one complete event per request, on the timeline of
+   // the thread which issued it, with the details in its arguments
+   //
+   // param path: the file to write
+   // returns:    kTRUE in case of success
+
+   FILE *out = fopen(path, "w");
+   if (!out) {
+      ::SysError("TNetXNGTrace::Dump", "cannot open %s", path);
+      return kFALSE;
+   }
+
+   XrdSysMutexHelper lock(gTraceMutex);
+   Long64_t size  = gTraceEvents.size();
+   Long64_t first = gTraceNext > size ? gTraceNext - size : 0;
+   Int_t    pid   = getpid();
+
+   fprintf(out, "{\"traceEvents\":[\n");
+   for (Long64_t i = first; i < gTraceNext; ++i) {
+      const TNetXNGTraceEvent &ev = gTraceEvents[i % size];
+      fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"netxng\",\"ph\":\"X\","
+              "\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%lld,\"args\":{",
+              i == first ? "" : ",\n", kOperationNames[ev.fOp], ev.fStart,
+              ev.fDuration, pid, ev.fThread);
+      fprintf(out, "\"file\":");
+      WriteJSONString(out, gTraceNames[ev.fFile]);
+      fprintf(out, ",\"server\":");
+      WriteJSONString(out, gTraceNames[ev.fServer]);
+      if (ev.fOffset >= 0)
+         fprintf(out, ",\"offset\":%lld", ev.fOffset);
+      fprintf(out, ",\"size\":%lld,\"chunks\":%d,\"status\":\"%s\"}}",
+              ev.fSize, ev.fNChunks, ev.fOK ? "ok" : "error");
+   }
+   fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+   Bool_t ok = !ferror(out);
+   if (fclose(out) || !ok) {
+      ::SysError("TNetXNGTrace::Dump", "cannot write %s", path);
+      return kFALSE;
+   }
+   return kTRUE;
+}